@@ -1,16 +1,36 @@
 #include "stdafx.h"
 #include <iostream>
 #include <mutex>
+#include <condition_variable>
 #include <stack>
+#include <queue>
+#include <memory>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <chrono>
+#include <stdexcept>
+#include <type_traits>
+
+#include "locks.h"
+#include "../../LF/Stack/ReclamationPolicy/lf_stack.h"
+#include "../../Threading/ATM/queue.h"
 
 using namespace std;
 
-template<typename T>
+// Lock is std::mutex or one of the policies from locks.h
+template<typename T, typename Lock = mutex>
 class ThreadsafeStack
 {
 private:
+	typedef typename conditional<is_same<Lock, mutex>::value, condition_variable, condition_variable_any>::type Condition;
+
 	stack<T> data;
-	mutable mutex m;
+	mutable Lock m;
+	Condition dataCond;
+	unsigned waiters = 0;
+
+	shared_ptr<T> PopLocked();
 public:
 	ThreadsafeStack() = default;
 	ThreadsafeStack(const ThreadsafeStack& other);
@@ -18,44 +38,348 @@ public:
 
 	void push(T new_value);
 	shared_ptr<T> pop();
+	shared_ptr<T> wait_and_pop();
+	template <typename Rep, typename Period>
+	shared_ptr<T> try_pop_for(chrono::duration<Rep, Period> const& timeout);
+	stack<T> pop_all();
 	bool empty() const;
 };
 
-template <typename T>
-ThreadsafeStack<T>::ThreadsafeStack(const ThreadsafeStack& other)
+template <typename T, typename Lock>
+ThreadsafeStack<T, Lock>::ThreadsafeStack(const ThreadsafeStack& other)
 {
-	lock_guard<mutex> lock(other.m);
+	lock_guard<Lock> lock(other.m);
 	data = other.data;
 }
 
-template <typename T>
-void ThreadsafeStack<T>::push(T newValue)
+template <typename T, typename Lock>
+void ThreadsafeStack<T, Lock>::push(T newValue)
 {
-	lock_guard<mutex> lock(m);
-	data.push(move(newValue));
+	bool wake;
+	{
+		lock_guard<Lock> lock(m);
+		data.push(move(newValue));
+		wake = waiters != 0;
+	}
+	if(wake)
+		dataCond.notify_one();
 }
 
-template <typename T>
-shared_ptr<T> ThreadsafeStack<T>::pop()
+template <typename T, typename Lock>
+shared_ptr<T> ThreadsafeStack<T, Lock>::PopLocked()
 {
-	lock_guard<mutex> lock(m);
-	shared_ptr<T> const res;
+	shared_ptr<T> res;
 	if(!data.empty())
 	{
-		res = make_shared<T>(move(data.top));
+		res = make_shared<T>(move(data.top()));
 		data.pop();
 	}
 	return res;
 }
 
+template <typename T, typename Lock>
+shared_ptr<T> ThreadsafeStack<T, Lock>::pop()
+{
+	lock_guard<Lock> lock(m);
+	return PopLocked();
+}
+
+template <typename T, typename Lock>
+shared_ptr<T> ThreadsafeStack<T, Lock>::wait_and_pop()
+{
+	unique_lock<Lock> lock(m);
+	++waiters;
+	dataCond.wait(lock, [this] { return !data.empty(); });
+	--waiters;
+	return PopLocked();
+}
+
+template <typename T, typename Lock>
+template <typename Rep, typename Period>
+shared_ptr<T> ThreadsafeStack<T, Lock>::try_pop_for(chrono::duration<Rep, Period> const& timeout)
+{
+	unique_lock<Lock> lock(m);
+	++waiters;
+	dataCond.wait_for(lock, timeout, [this] { return !data.empty(); });
+	--waiters;
+	return PopLocked();
+}
+
+template <typename T, typename Lock>
+stack<T> ThreadsafeStack<T, Lock>::pop_all()
+{
+	stack<T> res;
+	lock_guard<Lock> lock(m);
+	res.swap(data);
+	return res;
+}
+
+template <typename T, typename Lock>
+bool ThreadsafeStack<T, Lock>::empty() const
+{
+	lock_guard<Lock> lock(m);
+	return data.empty();
+}
+
+unsigned const MAX_COMBINING_THREADS = 64;
+atomic<bool> combining_slots[MAX_COMBINING_THREADS];
+atomic<unsigned> combining_slots_used{0};
+
+class CombiningSlotOwner
+{
+	unsigned index;
+public:
+	CombiningSlotOwner();
+
+	CombiningSlotOwner(CombiningSlotOwner const&) = delete;
+	CombiningSlotOwner operator=(CombiningSlotOwner const&) = delete;
+
+	~CombiningSlotOwner();
+
+	unsigned GetIndex() const;
+};
+
+CombiningSlotOwner::CombiningSlotOwner()
+: index(MAX_COMBINING_THREADS)
+{
+	for(unsigned i = 0; i < MAX_COMBINING_THREADS; i++)
+	{
+		bool used = false;
+		if(combining_slots[i].compare_exchange_strong(used, true))
+		{
+			index = i;
+			break;
+		}
+	}
+
+	if(index == MAX_COMBINING_THREADS)
+		throw runtime_error("No combining slots available");
+
+	unsigned used = combining_slots_used.load();
+	while(used <= index && !combining_slots_used.compare_exchange_weak(used, index + 1))
+		;
+}
+
+CombiningSlotOwner::~CombiningSlotOwner()
+{
+	combining_slots[index].store(false);
+}
+
+unsigned CombiningSlotOwner::GetIndex() const
+{
+	return index;
+}
+
+unsigned GetCombiningSlotForCurrentThread()
+{
+	thread_local static CombiningSlotOwner slot;
+	return slot.GetIndex();
+}
+
 template <typename T>
-bool ThreadsafeStack<T>::empty() const
+T& NextElement(stack<T>& s)
+{
+	return s.top();
+}
+
+template <typename T>
+T& NextElement(queue<T>& q)
+{
+	return q.front();
+}
+
+// Threads publish push/pop requests in their own record; whoever gets the
+// lock applies every pending request in one pass while the others spin on
+// their record instead of on the lock
+template <typename T, typename Sequence>
+class FlatCombining
+{
+private:
+	enum Operation { NONE, PUSH, POP };
+
+	struct alignas(64) Record
+	{
+		atomic<int> op{NONE};
+		T value;
+		shared_ptr<T> result;
+	};
+
+	mutex m;
+	Sequence data;
+	Record records[MAX_COMBINING_THREADS];
+
+	void Combine();
+	void Apply(Record& r);
+public:
+	FlatCombining() = default;
+	FlatCombining(const FlatCombining&) = delete;
+	FlatCombining& operator=(const FlatCombining&) = delete;
+
+	void push(T new_value);
+	shared_ptr<T> pop();
+	bool empty();
+};
+
+template <typename T, typename Sequence>
+void FlatCombining<T, Sequence>::Combine()
+{
+	unsigned const used = combining_slots_used.load(memory_order::memory_order_acquire);
+	for(unsigned i = 0; i < used; i++)
+	{
+		Record& r = records[i];
+		int const op = r.op.load(memory_order::memory_order_acquire);
+		if(op == PUSH)
+			data.push(move(r.value));
+		else if(op == POP && !data.empty())
+		{
+			r.result = make_shared<T>(move(NextElement(data)));
+			data.pop();
+		}
+		else if(op == POP)
+			r.result.reset();
+		else
+			continue;
+		r.op.store(NONE, memory_order::memory_order_release);
+	}
+}
+
+template <typename T, typename Sequence>
+void FlatCombining<T, Sequence>::Apply(Record& r)
+{
+	for(;;)
+	{
+		if(m.try_lock())
+		{
+			Combine();
+			m.unlock();
+			return;
+		}
+
+		for(unsigned spin = 0; spin < 128; spin++)
+		{
+			if(r.op.load(memory_order::memory_order_acquire) == NONE)
+				return;
+		}
+		this_thread::yield();
+		if(r.op.load(memory_order::memory_order_acquire) == NONE)
+			return;
+	}
+}
+
+template <typename T, typename Sequence>
+void FlatCombining<T, Sequence>::push(T newValue)
+{
+	Record& r = records[GetCombiningSlotForCurrentThread()];
+	r.value = move(newValue);
+	r.op.store(PUSH, memory_order::memory_order_release);
+	Apply(r);
+}
+
+template <typename T, typename Sequence>
+shared_ptr<T> FlatCombining<T, Sequence>::pop()
+{
+	Record& r = records[GetCombiningSlotForCurrentThread()];
+	r.op.store(POP, memory_order::memory_order_release);
+	Apply(r);
+	shared_ptr<T> res;
+	res.swap(r.result);
+	return res;
+}
+
+template <typename T, typename Sequence>
+bool FlatCombining<T, Sequence>::empty()
 {
 	lock_guard<mutex> lock(m);
 	return data.empty();
 }
 
+template <typename T>
+using FlatCombiningStack = FlatCombining<T, stack<T>>;
+
+template <typename T>
+using FlatCombiningQueue = FlatCombining<T, queue<T>>;
+
+// Gives messaging::basic_queue the push/pop shape the benchmark expects
+template <typename Lock>
+class MessageQueue
+{
+	messaging::basic_queue<Lock> q;
+public:
+	void push(int value)
+	{
+		q.push(value);
+	}
+
+	shared_ptr<messaging::message_base> pop()
+	{
+		shared_ptr<messaging::message_base> res;
+		q.try_pop(res);
+		return res;
+	}
+};
+
+template <typename Container>
+double Benchmark(unsigned threadsCount, int operations)
+{
+	Container container;
+	vector<thread> threads;
+
+	auto const start = chrono::steady_clock::now();
+	for(unsigned t = 0; t < threadsCount; t++)
+	{
+		threads.emplace_back([&]
+		{
+			for(int i = 0; i < operations; i++)
+			{
+				container.push(i);
+				container.pop();
+			}
+		});
+	}
+	for(thread& t : threads)
+		t.join();
+	chrono::duration<double> const elapsed = chrono::steady_clock::now() - start;
+
+	return threadsCount * operations / elapsed.count();
+}
+
 int main()
 {
+	ThreadsafeStack<int> ts;
+	thread consumer([&]
+	{
+		cout << "wait_and_pop: " << *ts.wait_and_pop() << endl;
+		cout << "try_pop_for: " << (ts.try_pop_for(chrono::milliseconds(10)) ? "value" : "timeout") << endl;
+	});
+	ts.push(1);
+	consumer.join();
+
+	ts.push(2);
+	ts.push(3);
+	stack<int> all = ts.pop_all();
+	cout << "pop_all: " << all.size() << " values, stack empty: " << ts.empty() << endl;
+	cout << endl;
+
+	int const operations = 100000;
+	unsigned const threadCounts[] = {1, 2, 4, 8};
+
+	cout << "push+pop/s per container and thread count\n";
+	for(unsigned threadsCount : threadCounts)
+	{
+		cout << threadsCount << " threads\n";
+		cout << "  mutex stack:          " << Benchmark<ThreadsafeStack<int>>(threadsCount, operations) << endl;
+		cout << "  ticket lock stack:    " << Benchmark<ThreadsafeStack<int, TicketLock>>(threadsCount, operations) << endl;
+		cout << "  MCS lock stack:       " << Benchmark<ThreadsafeStack<int, MCSLock>>(threadsCount, operations) << endl;
+		cout << "  hybrid lock stack:    " << Benchmark<ThreadsafeStack<int, HybridLock>>(threadsCount, operations) << endl;
+		cout << "  mutex mailbox:        " << Benchmark<MessageQueue<mutex>>(threadsCount, operations) << endl;
+		cout << "  ticket lock mailbox:  " << Benchmark<MessageQueue<TicketLock>>(threadsCount, operations) << endl;
+		cout << "  MCS lock mailbox:     " << Benchmark<MessageQueue<MCSLock>>(threadsCount, operations) << endl;
+		cout << "  hybrid lock mailbox:  " << Benchmark<MessageQueue<HybridLock>>(threadsCount, operations) << endl;
+		cout << "  flat combining stack: " << Benchmark<FlatCombiningStack<int>>(threadsCount, operations) << endl;
+		cout << "  flat combining queue: " << Benchmark<FlatCombiningQueue<int>>(threadsCount, operations) << endl;
+		cout << "  lock-free stack (HP): " << Benchmark<LFStack<int, HazardPointerReclaimer>>(threadsCount, operations) << endl;
+		cout << "  lock-free stack (EB): " << Benchmark<LFStack<int, EpochReclaimer>>(threadsCount, operations) << endl;
+	}
+
 	return 0;
-}
\ No newline at end of file
+}
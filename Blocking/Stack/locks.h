@@ -0,0 +1,282 @@
+#pragma once
+
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <cstdint>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <immintrin.h>
+#endif
+
+#if defined(_WIN32)
+#include <windows.h>
+#pragma comment(lib, "Synchronization.lib")
+#elif defined(__linux__)
+#include <linux/futex.h>
+#include <time.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+// Lock policies for the blocking containers. Each one is BasicLockable so it
+// can be used with std::lock_guard / std::unique_lock in place of std::mutex.
+
+inline void CpuRelax()
+{
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+	_mm_pause();
+#else
+	std::this_thread::yield();
+#endif
+}
+
+// Busy-waits a bit, then starts giving the core away so a preempted lock
+// holder gets a chance to run when there are more threads than cores
+inline void SpinWait(unsigned& spins)
+{
+	if(++spins < 64)
+		CpuRelax();
+	else
+		std::this_thread::yield();
+}
+
+// Sleeps while word == expected, may return spuriously
+inline void FutexWait(std::atomic<int>& word, int expected)
+{
+#if defined(_WIN32)
+	WaitOnAddress(&word, &expected, sizeof(expected), INFINITE);
+#elif defined(__linux__)
+	syscall(SYS_futex, reinterpret_cast<int*>(&word), FUTEX_WAIT_PRIVATE, expected, nullptr, nullptr, 0);
+#else
+	if(word.load(std::memory_order_relaxed) == expected)
+		std::this_thread::yield();
+#endif
+}
+
+// Same as FutexWait, but gives up after timeout
+inline void FutexWaitFor(std::atomic<int>& word, int expected, std::chrono::nanoseconds timeout)
+{
+	if(timeout <= std::chrono::nanoseconds::zero())
+		return;
+#if defined(_WIN32)
+	DWORD const ms = static_cast<DWORD>(std::chrono::duration_cast<std::chrono::milliseconds>(timeout).count());
+	WaitOnAddress(&word, &expected, sizeof(expected), ms ? ms : 1);
+#elif defined(__linux__)
+	timespec ts;
+	ts.tv_sec = static_cast<time_t>(timeout.count() / 1000000000);
+	ts.tv_nsec = static_cast<long>(timeout.count() % 1000000000);
+	syscall(SYS_futex, reinterpret_cast<int*>(&word), FUTEX_WAIT_PRIVATE, expected, &ts, nullptr, 0);
+#else
+	if(word.load(std::memory_order_relaxed) == expected)
+		std::this_thread::yield();
+#endif
+}
+
+inline void FutexWakeOne(std::atomic<int>& word)
+{
+#if defined(_WIN32)
+	WakeByAddressSingle(&word);
+#elif defined(__linux__)
+	syscall(SYS_futex, reinterpret_cast<int*>(&word), FUTEX_WAKE_PRIVATE, 1, nullptr, nullptr, 0);
+#else
+	(void)word;
+#endif
+}
+
+inline void FutexWakeAll(std::atomic<int>& word)
+{
+#if defined(_WIN32)
+	WakeByAddressAll(&word);
+#elif defined(__linux__)
+	syscall(SYS_futex, reinterpret_cast<int*>(&word), FUTEX_WAKE_PRIVATE, INT32_MAX, nullptr, nullptr, 0);
+#else
+	(void)word;
+#endif
+}
+
+// FIFO spin lock: take a ticket, wait until it is served
+class TicketLock
+{
+	alignas(64) std::atomic<unsigned> next{0};
+	alignas(64) std::atomic<unsigned> serving{0};
+public:
+	TicketLock() = default;
+	TicketLock(TicketLock const&) = delete;
+	TicketLock& operator=(TicketLock const&) = delete;
+
+	void lock()
+	{
+		unsigned const ticket = next.fetch_add(1, std::memory_order_relaxed);
+		unsigned spins = 0;
+		while(serving.load(std::memory_order_acquire) != ticket)
+			SpinWait(spins);
+	}
+
+	bool try_lock()
+	{
+		unsigned ticket = serving.load(std::memory_order_relaxed);
+		return next.compare_exchange_strong(ticket, ticket + 1, std::memory_order_acquire, std::memory_order_relaxed);
+	}
+
+	void unlock()
+	{
+		serving.store(serving.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+	}
+};
+
+// FIFO queue lock: every waiter spins on a flag in its own node, so a release
+// touches only the successor's cache line
+class MCSLock
+{
+	struct alignas(64) Node
+	{
+		std::atomic<Node*> next;
+		std::atomic<bool> locked;
+	};
+
+	// Nodes live on the acquiring thread; every lock it holds or waits for
+	// has a node of its own. Locks may be released in any order, so a free
+	// node is looked up rather than taken by depth. Beyond MAX_NESTED nested
+	// locks the nodes come from the heap.
+	static unsigned const MAX_NESTED = 8;
+
+	struct LocalNodes
+	{
+		Node nodes[MAX_NESTED];
+		unsigned used = 0;
+	};
+
+	static LocalNodes& GetLocalNodes()
+	{
+		thread_local static LocalNodes local;
+		return local;
+	}
+
+	static Node* AcquireNode()
+	{
+		LocalNodes& local = GetLocalNodes();
+		for(unsigned i = 0; i < MAX_NESTED; i++)
+		{
+			if(!(local.used & (1u << i)))
+			{
+				local.used |= 1u << i;
+				return &local.nodes[i];
+			}
+		}
+		return new Node;
+	}
+
+	// Nothing refers to the node any more once it is handed on or unqueued
+	static void ReleaseNode(Node* node)
+	{
+		LocalNodes& local = GetLocalNodes();
+		if(node >= local.nodes && node < local.nodes + MAX_NESTED)
+			local.used &= ~(1u << (node - local.nodes));
+		else
+			delete node;
+	}
+
+	std::atomic<Node*> tail{nullptr};
+	Node* owner = nullptr;
+public:
+	MCSLock() = default;
+	MCSLock(MCSLock const&) = delete;
+	MCSLock& operator=(MCSLock const&) = delete;
+
+	void lock()
+	{
+		Node* const node = AcquireNode();
+		node->next.store(nullptr, std::memory_order_relaxed);
+		node->locked.store(true, std::memory_order_relaxed);
+
+		Node* const prev = tail.exchange(node, std::memory_order_acq_rel);
+		if(prev)
+		{
+			prev->next.store(node, std::memory_order_release);
+			unsigned spins = 0;
+			while(node->locked.load(std::memory_order_acquire))
+				SpinWait(spins);
+		}
+		owner = node;
+	}
+
+	bool try_lock()
+	{
+		Node* const node = AcquireNode();
+		node->next.store(nullptr, std::memory_order_relaxed);
+
+		Node* expected = nullptr;
+		if(!tail.compare_exchange_strong(expected, node, std::memory_order_acquire, std::memory_order_relaxed))
+		{
+			ReleaseNode(node);
+			return false;
+		}
+		owner = node;
+		return true;
+	}
+
+	void unlock()
+	{
+		Node* const node = owner;
+		Node* next = node->next.load(std::memory_order_acquire);
+		if(!next)
+		{
+			Node* expected = node;
+			if(tail.compare_exchange_strong(expected, nullptr, std::memory_order_release, std::memory_order_relaxed))
+			{
+				ReleaseNode(node);
+				return;
+			}
+			unsigned spins = 0;
+			while(!(next = node->next.load(std::memory_order_acquire)))
+				SpinWait(spins);
+		}
+		next->locked.store(false, std::memory_order_release);
+		ReleaseNode(node);
+	}
+};
+
+// Spins for a short while in user space, then sleeps on a futex.
+// state: 0 unlocked, 1 locked, 2 locked and somebody may be sleeping
+class HybridLock
+{
+	static unsigned const SPIN_COUNT = 100;
+
+	std::atomic<int> state{0};
+public:
+	HybridLock() = default;
+	HybridLock(HybridLock const&) = delete;
+	HybridLock& operator=(HybridLock const&) = delete;
+
+	void lock()
+	{
+		int expected = 0;
+		for(unsigned spin = 0; spin < SPIN_COUNT; spin++)
+		{
+			if(state.compare_exchange_weak(expected, 1, std::memory_order_acquire, std::memory_order_relaxed))
+				return;
+			expected = 0;
+			CpuRelax();
+		}
+
+		int current = state.exchange(2, std::memory_order_acquire);
+		while(current != 0)
+		{
+			FutexWait(state, 2);
+			current = state.exchange(2, std::memory_order_acquire);
+		}
+	}
+
+	bool try_lock()
+	{
+		int expected = 0;
+		return state.compare_exchange_strong(expected, 1, std::memory_order_acquire, std::memory_order_relaxed);
+	}
+
+	void unlock()
+	{
+		if(state.exchange(0, std::memory_order_release) == 2)
+			FutexWakeOne(state);
+	}
+};
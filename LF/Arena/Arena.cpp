@@ -0,0 +1,205 @@
+#include "stdafx.h"
+#include <iostream>
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+#include <chrono>
+#include <cstring>
+#include <cstdint>
+
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include "../arena.h"
+#include "../Stack/ReclamationPolicy/lf_stack.h"
+
+using namespace std;
+
+// Data TLB read misses of the calling thread, where perf events are available
+class TlbMissCounter
+{
+	int fd;
+public:
+	TlbMissCounter() : fd(-1)
+	{
+#if defined(__linux__)
+		perf_event_attr attr;
+		memset(&attr, 0, sizeof(attr));
+		attr.type = PERF_TYPE_HW_CACHE;
+		attr.size = sizeof(attr);
+		attr.config = PERF_COUNT_HW_CACHE_DTLB |
+			(PERF_COUNT_HW_CACHE_OP_READ << 8) |
+			(PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+		attr.disabled = 1;
+		attr.exclude_kernel = 1;
+		attr.exclude_hv = 1;
+		fd = static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+#endif
+	}
+
+	TlbMissCounter(TlbMissCounter const&) = delete;
+	TlbMissCounter& operator=(TlbMissCounter const&) = delete;
+
+	~TlbMissCounter()
+	{
+#if defined(__linux__)
+		if(fd >= 0)
+			close(fd);
+#endif
+	}
+
+	bool Available() const
+	{
+		return fd >= 0;
+	}
+
+	void Start()
+	{
+#if defined(__linux__)
+		if(fd >= 0)
+		{
+			ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+			ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+		}
+#endif
+	}
+
+	long long Stop()
+	{
+		long long count = -1;
+#if defined(__linux__)
+		if(fd >= 0)
+		{
+			ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+			if(read(fd, &count, sizeof(count)) != sizeof(count))
+				count = -1;
+		}
+#endif
+		return count;
+	}
+};
+
+struct Result
+{
+	double pushRate;
+	double popRate;
+	long long tlbMisses;
+};
+
+// Several producers fill the stack at once, so heap nodes end up interleaved
+// with each other and with their data, then one thread chases the whole chain
+template <typename Allocator>
+Result Benchmark(unsigned threadsCount, int perThread)
+{
+	Result result;
+	LFStack<int, LeakReclaimer, Allocator> stack;
+	vector<thread> threads;
+
+	auto start = chrono::steady_clock::now();
+	for(unsigned t = 0; t < threadsCount; t++)
+	{
+		threads.emplace_back([&]
+		{
+			for(int i = 0; i < perThread; i++)
+				stack.push(i);
+		});
+	}
+	for(thread& t : threads)
+		t.join();
+	chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+	result.pushRate = threadsCount * perThread / elapsed.count();
+
+	TlbMissCounter tlb;
+	start = chrono::steady_clock::now();
+	tlb.Start();
+	long long sum = 0;
+	while(shared_ptr<int> v = stack.pop())
+		sum += *v;
+	result.tlbMisses = tlb.Stop();
+	elapsed = chrono::steady_clock::now() - start;
+	result.popRate = threadsCount * perThread / elapsed.count();
+
+	if(sum < 0)
+		cout << sum;
+	return result;
+}
+
+// Producers push while consumers pop, so every node is allocated on one
+// thread and freed by the epoch reclaimer on another. Returns pops per second.
+template <typename Allocator>
+double HandoffBenchmark(unsigned pairsCount, int perProducer)
+{
+	LFStack<int, EpochReclaimer, Allocator> stack;
+	atomic<long long> remaining(static_cast<long long>(pairsCount) * perProducer);
+	vector<thread> threads;
+
+	auto const start = chrono::steady_clock::now();
+	for(unsigned t = 0; t < pairsCount; t++)
+	{
+		threads.emplace_back([&]
+		{
+			for(int i = 0; i < perProducer; i++)
+				stack.push(i);
+		});
+		threads.emplace_back([&]
+		{
+			while(remaining.load(memory_order_relaxed) > 0)
+			{
+				if(stack.pop())
+					remaining.fetch_sub(1, memory_order_relaxed);
+			}
+		});
+	}
+	for(thread& t : threads)
+		t.join();
+	chrono::duration<double> const elapsed = chrono::steady_clock::now() - start;
+	return pairsCount * perProducer / elapsed.count();
+}
+
+void Print(char const *name, Result const& r)
+{
+	cout << name << "push " << r.pushRate << "/s, pop " << r.popRate << "/s, dTLB misses ";
+	if(r.tlbMisses < 0)
+		cout << "n/a";
+	else
+		cout << r.tlbMisses;
+	cout << endl;
+}
+
+int main()
+{
+	unsigned const threadsCount = 4;
+	int const perThread = 1000000;
+
+	Result const heap = Benchmark<HeapAllocator>(threadsCount, perThread);
+	Result const arena = Benchmark<ArenaAllocator>(threadsCount, perThread);
+
+	HugePageArena::Stats const stats = GetNodeArena().GetStats();
+	cout << "arena regions: " << stats.regions << " (explicit huge " << stats.explicitHuge
+		 << ", transparent huge " << stats.transparentHuge << ", normal " << stats.normal << ")" << endl;
+	GetNodeArena().Release();
+
+	Print("heap:  ", heap);
+	Print("arena: ", arena);
+	cout << endl;
+
+	// Every round runs on fresh threads. The arena has to reuse the nodes
+	// freed by the consumers and the threads of the round before, otherwise
+	// it maps more regions each round.
+	unsigned const pairsCount = 2;
+	int const perProducer = 500000;
+	cout << "handoff, heap:  " << HandoffBenchmark<HeapAllocator>(pairsCount, perProducer) << " pops/s" << endl;
+	for(int round = 1; round <= 4; round++)
+	{
+		double const rate = HandoffBenchmark<ArenaAllocator>(pairsCount, perProducer);
+		cout << "handoff, arena: " << rate << " pops/s, regions " << GetNodeArena().GetStats().regions << endl;
+	}
+	GetNodeArena().Release();
+
+	return 0;
+}
@@ -0,0 +1,110 @@
+#include "stdafx.h"
+#include <iostream>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <chrono>
+#include <random>
+#include <unordered_map>
+
+#include "split_ordered_map.h"
+
+using namespace std;
+
+template <typename K, typename V>
+class MutexHashMap
+{
+	mutex m;
+	unordered_map<K, V> data;
+public:
+	bool insert(K const& key, V const& value)
+	{
+		lock_guard<mutex> lock(m);
+		return data.emplace(key, value).second;
+	}
+
+	bool find(K const& key, V& value)
+	{
+		lock_guard<mutex> lock(m);
+		auto const it = data.find(key);
+		if(it == data.end())
+			return false;
+		value = it->second;
+		return true;
+	}
+
+	bool erase(K const& key)
+	{
+		lock_guard<mutex> lock(m);
+		return data.erase(key) != 0;
+	}
+};
+
+// Lookup heavy mix: 80% find, 10% insert, 10% erase over a fixed key range
+template <typename Map>
+double Benchmark(unsigned threadsCount, int operations, int keys)
+{
+	Map map;
+	for(int k = 0; k < keys; k += 2)
+		map.insert(k, k);
+
+	vector<thread> threads;
+	auto const start = chrono::steady_clock::now();
+	for(unsigned t = 0; t < threadsCount; t++)
+	{
+		threads.emplace_back([&, t]
+		{
+			mt19937 random(t);
+			uniform_int_distribution<int> keyOf(0, keys - 1);
+			uniform_int_distribution<int> operationOf(0, 9);
+			int value;
+			for(int i = 0; i < operations; i++)
+			{
+				int const key = keyOf(random);
+				int const operation = operationOf(random);
+				if(operation == 0)
+					map.insert(key, key);
+				else if(operation == 1)
+					map.erase(key);
+				else
+					map.find(key, value);
+			}
+		});
+	}
+	for(thread& t : threads)
+		t.join();
+	chrono::duration<double> const elapsed = chrono::steady_clock::now() - start;
+
+	return threadsCount * operations / elapsed.count();
+}
+
+int main()
+{
+	LFHashMap<int, int> map;
+
+	for(int i = 0; i < 100; i++)
+		map.insert(i, i * i);
+	map.erase(7);
+
+	int value = 0;
+	cout << "find 9: " << (map.find(9, value) ? value : -1) << endl;
+	cout << "find 7: " << (map.find(7, value) ? value : -1) << endl;
+	cout << "insert 9 again: " << (map.insert(9, 0) ? "inserted" : "exists") << endl;
+	cout << "size: " << map.size() << endl;
+	cout << endl;
+
+	int const operations = 500000;
+	int const keys = 100000;
+	unsigned const threadCounts[] = {1, 2, 4, 8};
+
+	cout << "ops/s, 80% find / 10% insert / 10% erase\n";
+	for(unsigned threadsCount : threadCounts)
+	{
+		cout << threadsCount << " threads\n";
+		cout << "  split-ordered map: " << Benchmark<LFHashMap<int, int>>(threadsCount, operations, keys) << endl;
+		cout << "  mutex map:         " << Benchmark<MutexHashMap<int, int>>(threadsCount, operations, keys) << endl;
+	}
+
+	return 0;
+}
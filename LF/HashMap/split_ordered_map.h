@@ -0,0 +1,389 @@
+#pragma once
+
+#include <atomic>
+#include <utility>
+#include <functional>
+#include <cstddef>
+#include <cstdint>
+
+#include "../Stack/HazzardPointers/hazard_pointers.h"
+
+// Split-ordered list hash map (Shalev & Shavit).
+//
+// All entries live in one lock-free sorted list (Michael's algorithm with
+// marked next pointers). The list is ordered by the bit-reversed hash, so
+// every bucket is a contiguous run that starts with a dummy node, and
+// doubling the bucket count only splits runs: a new bucket is initialized
+// lazily on first use by linking its dummy node after the parent bucket's.
+// Nothing is ever rehashed or moved.
+//
+// Dummy nodes and the bucket segments stay until the map is destroyed.
+// Erased entries are retired to the thread's RetiredList and freed once no
+// hazard pointer refers to them. Hazard pointers are published with the
+// asymmetric fence, so a lookup pays no full fence per node it visits.
+template <typename K, typename V, typename Hash = std::hash<K>>
+class LFHashMap
+{
+private:
+	static unsigned const MAX_SEGMENTS = 33;
+	static std::size_t const LOAD_FACTOR = 2;
+	static std::uint64_t const HIGH_BIT = std::uint64_t(1) << 63;
+
+	struct Node
+	{
+		std::uint64_t orderKey;
+		K key;
+		V value;
+		std::atomic<Node*> next;
+
+		explicit Node(std::uint64_t orderKey_) : orderKey(orderKey_), key(), value(), next(nullptr) {}
+		Node(std::uint64_t orderKey_, K const& key_, V const& value_) :
+			orderKey(orderKey_), key(key_), value(value_), next(nullptr)
+		{}
+	};
+
+	// Where a key is or would be: *prev == curr, both protected
+	struct Position
+	{
+		std::atomic<Node*> *prev;
+		Node *curr;
+		Node *next;
+	};
+
+	// Segment 0 holds bucket 0, segment k > 0 holds buckets [2^(k-1), 2^k)
+	std::atomic<std::atomic<Node*>*> segments[MAX_SEGMENTS];
+	std::atomic<std::size_t> bucketCount;
+	std::atomic<std::size_t> count;
+	Hash hasher;
+
+	static Node* Marked(Node *p)
+	{
+		return reinterpret_cast<Node*>(reinterpret_cast<std::uintptr_t>(p) | 1);
+	}
+
+	static Node* Unmarked(Node *p)
+	{
+		return reinterpret_cast<Node*>(reinterpret_cast<std::uintptr_t>(p) & ~std::uintptr_t(1));
+	}
+
+	static bool IsMarked(Node *p)
+	{
+		return reinterpret_cast<std::uintptr_t>(p) & 1;
+	}
+
+	static std::uint64_t ReverseBits(std::uint64_t x);
+	static std::uint64_t RegularKey(std::uint64_t hash);
+	static std::uint64_t DummyKey(std::size_t bucket);
+	static unsigned SegmentOf(std::size_t bucket);
+	static std::size_t SegmentStart(unsigned segment);
+	static std::size_t ParentOf(std::size_t bucket);
+
+	static std::atomic<void*>& Hazard(unsigned i);
+	static void ClearHazards();
+	static void Retire(Node *node);
+
+	std::uint64_t HashOf(K const& key) const;
+	std::atomic<Node*>& BucketSlot(std::size_t bucket);
+	Node* GetBucket(std::size_t bucket);
+	void InitializeBucket(std::size_t bucket);
+	bool Find(Node *head, std::uint64_t orderKey, K const& key, Position& pos);
+public:
+	LFHashMap();
+	LFHashMap(LFHashMap const&) = delete;
+	LFHashMap& operator=(LFHashMap const&) = delete;
+	~LFHashMap();
+
+	bool insert(K const& key, V const& value);
+	bool find(K const& key, V& value);
+	bool erase(K const& key);
+	std::size_t size() const;
+};
+
+template <typename K, typename V, typename Hash>
+LFHashMap<K, V, Hash>::LFHashMap() : bucketCount(2), count(0)
+{
+	for(unsigned i = 0; i < MAX_SEGMENTS; i++)
+		segments[i].store(nullptr, std::memory_order_relaxed);
+
+	std::atomic<Node*> *const first = new std::atomic<Node*>[1];
+	first[0].store(new Node(DummyKey(0)), std::memory_order_relaxed);
+	segments[0].store(first, std::memory_order_release);
+}
+
+template <typename K, typename V, typename Hash>
+LFHashMap<K, V, Hash>::~LFHashMap()
+{
+	Node *n = segments[0].load()[0].load();
+	while(n)
+	{
+		Node *const next = Unmarked(n->next.load());
+		delete n;
+		n = next;
+	}
+	for(unsigned i = 0; i < MAX_SEGMENTS; i++)
+		delete[] segments[i].load();
+}
+
+template <typename K, typename V, typename Hash>
+std::uint64_t LFHashMap<K, V, Hash>::ReverseBits(std::uint64_t x)
+{
+	x = ((x >> 1) & 0x5555555555555555ull) | ((x & 0x5555555555555555ull) << 1);
+	x = ((x >> 2) & 0x3333333333333333ull) | ((x & 0x3333333333333333ull) << 2);
+	x = ((x >> 4) & 0x0F0F0F0F0F0F0F0Full) | ((x & 0x0F0F0F0F0F0F0F0Full) << 4);
+	x = ((x >> 8) & 0x00FF00FF00FF00FFull) | ((x & 0x00FF00FF00FF00FFull) << 8);
+	x = ((x >> 16) & 0x0000FFFF0000FFFFull) | ((x & 0x0000FFFF0000FFFFull) << 16);
+	return (x >> 32) | (x << 32);
+}
+
+// Regular keys get the low bit set so they sort after their bucket's dummy
+template <typename K, typename V, typename Hash>
+std::uint64_t LFHashMap<K, V, Hash>::RegularKey(std::uint64_t hash)
+{
+	return ReverseBits(hash | HIGH_BIT);
+}
+
+template <typename K, typename V, typename Hash>
+std::uint64_t LFHashMap<K, V, Hash>::DummyKey(std::size_t bucket)
+{
+	return ReverseBits(bucket);
+}
+
+template <typename K, typename V, typename Hash>
+unsigned LFHashMap<K, V, Hash>::SegmentOf(std::size_t bucket)
+{
+	return bucket ? HighestSetBit(bucket) + 1 : 0;
+}
+
+template <typename K, typename V, typename Hash>
+std::size_t LFHashMap<K, V, Hash>::SegmentStart(unsigned segment)
+{
+	return segment ? std::size_t(1) << (segment - 1) : 0;
+}
+
+// The bucket this one splits off from: same index without its highest bit
+template <typename K, typename V, typename Hash>
+std::size_t LFHashMap<K, V, Hash>::ParentOf(std::size_t bucket)
+{
+	return bucket & ~SegmentStart(SegmentOf(bucket));
+}
+
+// Find keeps the node owning prev and curr in these two, which swap roles
+template <typename K, typename V, typename Hash>
+std::atomic<void*>& LFHashMap<K, V, Hash>::Hazard(unsigned i)
+{
+	return GetHazardPointerForCurrentThread<2>(i);
+}
+
+template <typename K, typename V, typename Hash>
+void LFHashMap<K, V, Hash>::ClearHazards()
+{
+	Hazard(0).store(nullptr, std::memory_order_release);
+	Hazard(1).store(nullptr, std::memory_order_release);
+}
+
+template <typename K, typename V, typename Hash>
+void LFHashMap<K, V, Hash>::Retire(Node *node)
+{
+	RetiredList &retired = GetRetiredListForCurrentThread();
+	retired.Retire(node);
+	if(retired.Full())
+	{
+		AsymmetricFence::BeforeScan();
+		retired.DeleteNodesWithNoHazards();
+	}
+}
+
+template <typename K, typename V, typename Hash>
+std::uint64_t LFHashMap<K, V, Hash>::HashOf(K const& key) const
+{
+	return static_cast<std::uint64_t>(hasher(key)) & ~HIGH_BIT;
+}
+
+template <typename K, typename V, typename Hash>
+std::atomic<typename LFHashMap<K, V, Hash>::Node*>& LFHashMap<K, V, Hash>::BucketSlot(std::size_t bucket)
+{
+	unsigned const segment = SegmentOf(bucket);
+	std::atomic<Node*> *slots = segments[segment].load(std::memory_order_acquire);
+	if(!slots)
+	{
+		std::size_t const size = segment ? SegmentStart(segment) : 1;
+		std::atomic<Node*> *const fresh = new std::atomic<Node*>[size];
+		for(std::size_t i = 0; i < size; i++)
+			fresh[i].store(nullptr, std::memory_order_relaxed);
+		if(segments[segment].compare_exchange_strong(slots, fresh, std::memory_order_acq_rel, std::memory_order_acquire))
+			slots = fresh;
+		else
+			delete[] fresh;
+	}
+	return slots[bucket - SegmentStart(segment)];
+}
+
+template <typename K, typename V, typename Hash>
+typename LFHashMap<K, V, Hash>::Node* LFHashMap<K, V, Hash>::GetBucket(std::size_t bucket)
+{
+	std::atomic<Node*> &slot = BucketSlot(bucket);
+	Node *head = slot.load(std::memory_order_acquire);
+	if(!head)
+	{
+		InitializeBucket(bucket);
+		head = slot.load(std::memory_order_acquire);
+	}
+	return head;
+}
+
+template <typename K, typename V, typename Hash>
+void LFHashMap<K, V, Hash>::InitializeBucket(std::size_t bucket)
+{
+	Node *const parent = GetBucket(ParentOf(bucket));
+	Node *dummy = new Node(DummyKey(bucket));
+
+	Position pos;
+	for(;;)
+	{
+		if(Find(parent, dummy->orderKey, dummy->key, pos))
+		{
+			delete dummy;
+			dummy = pos.curr;
+			break;
+		}
+		dummy->next.store(pos.curr, std::memory_order_relaxed);
+		if(pos.prev->compare_exchange_strong(pos.curr, dummy, std::memory_order_release, std::memory_order_relaxed))
+			break;
+	}
+	ClearHazards();
+
+	Node *expected = nullptr;
+	BucketSlot(bucket).compare_exchange_strong(expected, dummy, std::memory_order_release, std::memory_order_relaxed);
+}
+
+// Walks from a bucket's dummy node, unlinking marked nodes on the way
+template <typename K, typename V, typename Hash>
+bool LFHashMap<K, V, Hash>::Find(Node *head, std::uint64_t orderKey, K const& key, Position& pos)
+{
+	// A node stays in the slot it was published in: on each step the slots
+	// trade roles and next goes into the one prev no longer needs, so a scan
+	// never catches the node while it moves between slots
+	std::atomic<void*> *hpPrev = &Hazard(0);
+	std::atomic<void*> *hpCurr = &Hazard(1);
+	bool const dummySearch = !(orderKey & 1);
+
+retry:
+	std::atomic<Node*> *prev = &head->next;
+	Node *curr = prev->load(std::memory_order_acquire);
+	for(;;)
+	{
+		if(!curr)
+		{
+			pos = Position{prev, nullptr, nullptr};
+			return false;
+		}
+
+		AsymmetricFence::Publish(*hpCurr, curr);
+		if(prev->load(std::memory_order_acquire) != curr)
+			goto retry;
+
+		Node *const next = curr->next.load(std::memory_order_acquire);
+		if(IsMarked(next))
+		{
+			Node *expected = curr;
+			if(!prev->compare_exchange_strong(expected, Unmarked(next), std::memory_order_acq_rel, std::memory_order_relaxed))
+				goto retry;
+			Retire(curr);
+			curr = Unmarked(next);
+			continue;
+		}
+
+		if(curr->orderKey > orderKey ||
+		   (curr->orderKey == orderKey && (dummySearch || !(curr->key < key))))
+		{
+			pos = Position{prev, curr, next};
+			return curr->orderKey == orderKey && (dummySearch || !(key < curr->key));
+		}
+
+		prev = &curr->next;
+		std::swap(hpPrev, hpCurr);
+		curr = next;
+	}
+}
+
+// false when the key is already there, the stored value is left as is
+template <typename K, typename V, typename Hash>
+bool LFHashMap<K, V, Hash>::insert(K const& key, V const& value)
+{
+	std::uint64_t const hash = HashOf(key);
+	std::size_t const buckets = bucketCount.load(std::memory_order_acquire);
+	Node *const head = GetBucket(hash & (buckets - 1));
+	Node *const node = new Node(RegularKey(hash), key, value);
+
+	Position pos;
+	for(;;)
+	{
+		if(Find(head, node->orderKey, key, pos))
+		{
+			ClearHazards();
+			delete node;
+			return false;
+		}
+		node->next.store(pos.curr, std::memory_order_relaxed);
+		if(pos.prev->compare_exchange_strong(pos.curr, node, std::memory_order_release, std::memory_order_relaxed))
+			break;
+	}
+	ClearHazards();
+
+	std::size_t const items = count.fetch_add(1, std::memory_order_relaxed) + 1;
+	std::size_t current = buckets;
+	if(items / current > LOAD_FACTOR && current < SegmentStart(MAX_SEGMENTS - 1))
+		bucketCount.compare_exchange_strong(current, current * 2, std::memory_order_release, std::memory_order_relaxed);
+	return true;
+}
+
+template <typename K, typename V, typename Hash>
+bool LFHashMap<K, V, Hash>::find(K const& key, V& value)
+{
+	std::uint64_t const hash = HashOf(key);
+	Node *const head = GetBucket(hash & (bucketCount.load(std::memory_order_acquire) - 1));
+
+	Position pos;
+	bool const found = Find(head, RegularKey(hash), key, pos);
+	if(found)
+		value = pos.curr->value;
+	ClearHazards();
+	return found;
+}
+
+template <typename K, typename V, typename Hash>
+bool LFHashMap<K, V, Hash>::erase(K const& key)
+{
+	std::uint64_t const hash = HashOf(key);
+	std::uint64_t const orderKey = RegularKey(hash);
+	Node *const head = GetBucket(hash & (bucketCount.load(std::memory_order_acquire) - 1));
+
+	Position pos;
+	for(;;)
+	{
+		if(!Find(head, orderKey, key, pos))
+		{
+			ClearHazards();
+			return false;
+		}
+		Node *next = pos.next;
+		if(!pos.curr->next.compare_exchange_strong(next, Marked(next), std::memory_order_acq_rel, std::memory_order_relaxed))
+			continue;
+
+		Node *expected = pos.curr;
+		if(pos.prev->compare_exchange_strong(expected, next, std::memory_order_acq_rel, std::memory_order_relaxed))
+			Retire(pos.curr);
+		else
+			Find(head, orderKey, key, pos);
+		break;
+	}
+	ClearHazards();
+	count.fetch_sub(1, std::memory_order_relaxed);
+	return true;
+}
+
+template <typename K, typename V, typename Hash>
+std::size_t LFHashMap<K, V, Hash>::size() const
+{
+	return count.load(std::memory_order_relaxed);
+}
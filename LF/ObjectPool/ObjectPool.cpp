@@ -0,0 +1,105 @@
+#include "stdafx.h"
+#include <iostream>
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+#include <chrono>
+
+#include "object_pool.h"
+
+using namespace std;
+
+struct Buffer
+{
+	int id;
+	char payload[4096];
+
+	explicit Buffer(int id_) : id(id_)
+	{
+		payload[0] = 0;
+	}
+};
+
+struct HeapAllocator
+{
+	Buffer* acquire(int id)
+	{
+		return new Buffer(id);
+	}
+
+	void release(Buffer *b)
+	{
+		delete b;
+	}
+};
+
+// Each thread keeps a handful of buffers alive at a time, like a message
+// pipeline with several requests in flight
+template <typename Allocator>
+double Benchmark(Allocator& allocator, unsigned threadsCount, int operations)
+{
+	int const inFlight = 16;
+	vector<thread> threads;
+
+	auto const start = chrono::steady_clock::now();
+	for(unsigned t = 0; t < threadsCount; t++)
+	{
+		threads.emplace_back([&]
+		{
+			Buffer* buffers[inFlight];
+			for(int i = 0; i < operations; i += inFlight)
+			{
+				for(int j = 0; j < inFlight; j++)
+					buffers[j] = allocator.acquire(i + j);
+				for(int j = 0; j < inFlight; j++)
+					allocator.release(buffers[j]);
+			}
+		});
+	}
+	for(thread& t : threads)
+		t.join();
+	chrono::duration<double> const elapsed = chrono::steady_clock::now() - start;
+
+	return threadsCount * operations / elapsed.count();
+}
+
+void PrintStats(PoolStats const& stats)
+{
+	cout << "acquires:        " << stats.acquires << endl;
+	cout << "cache hits:      " << stats.cacheHits << endl;
+	cout << "shared hits:     " << stats.sharedHits << endl;
+	cout << "hit rate:        " << stats.HitRate() * 100 << "%" << endl;
+	cout << "high-water mark: " << stats.highWaterMark << " slots" << endl;
+}
+
+int main()
+{
+	ObjectPool<Buffer> pool;
+
+	{
+		ObjectPool<Buffer>::Handle a = pool.make_handle(1);
+		ObjectPool<Buffer>::Handle b = pool.make_handle(2);
+		cout << "handles: " << a->id << " " << b->id << endl;
+	}
+	Buffer *const reused = pool.acquire(3);
+	cout << "acquire after release: " << reused->id << endl;
+	pool.release(reused);
+	cout << endl;
+
+	unsigned const threadsCount = 4;
+	int const operations = 1000000;
+
+	ObjectPool<Buffer> benchPool;
+	HeapAllocator heap;
+	double const pooled = Benchmark(benchPool, threadsCount, operations);
+	double const heaped = Benchmark(heap, threadsCount, operations);
+
+	cout << "pool:       " << pooled << " acquire+release/s" << endl;
+	cout << "new/delete: " << heaped << " acquire+release/s" << endl;
+	cout << endl;
+
+	PrintStats(benchPool.Stats());
+
+	return 0;
+}
@@ -0,0 +1,334 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <new>
+#include <utility>
+#include <cstdint>
+
+// ObjectPool<T> recycles the storage of released objects instead of handing
+// it back to the heap. A thread first goes to its own cache of free slots,
+// then to the shared free-list (a Treiber stack with a tagged head, so ABA is
+// covered by a double-width CAS), and only when both are empty carves a new
+// chunk of slots. Chunks are kept until the pool itself is destroyed.
+
+unsigned const MAX_POOL_THREADS = 64;
+unsigned const NO_POOL_THREAD = MAX_POOL_THREADS;
+
+inline std::atomic<bool>* GetPoolThreadSlots()
+{
+	static std::atomic<bool> slots[MAX_POOL_THREADS];
+	return slots;
+}
+
+class PoolThreadOwner
+{
+	unsigned index;
+public:
+	PoolThreadOwner() : index(NO_POOL_THREAD)
+	{
+		std::atomic<bool>* const slots = GetPoolThreadSlots();
+		for(unsigned i = 0; i < MAX_POOL_THREADS; i++)
+		{
+			bool used = false;
+			if(slots[i].compare_exchange_strong(used, true))
+			{
+				index = i;
+				break;
+			}
+		}
+	}
+
+	PoolThreadOwner(PoolThreadOwner const&) = delete;
+	PoolThreadOwner operator=(PoolThreadOwner const&) = delete;
+
+	~PoolThreadOwner()
+	{
+		if(index != NO_POOL_THREAD)
+			GetPoolThreadSlots()[index].store(false);
+	}
+
+	unsigned GetIndex() const
+	{
+		return index;
+	}
+};
+
+// Index of the calling thread's cache, NO_POOL_THREAD when they are all taken
+inline unsigned GetPoolThreadIndex()
+{
+	thread_local static PoolThreadOwner owner;
+	return owner.GetIndex();
+}
+
+struct PoolStats
+{
+	std::uint64_t acquires;
+	std::uint64_t cacheHits;      // served from the thread cache
+	std::uint64_t sharedHits;     // served from the shared free-list
+	std::uint64_t highWaterMark;  // slots carved so far: the pool never
+	                              // shrinks, so this is its peak footprint
+
+	double HitRate() const
+	{
+		return acquires ? double(cacheHits + sharedHits) / acquires : 0.0;
+	}
+};
+
+template <typename T>
+class ObjectPool
+{
+private:
+	static unsigned const CACHE_SIZE = 32;
+	static unsigned const CHUNK_SIZE = 64;
+
+	struct Slot
+	{
+		alignas(T) unsigned char storage[sizeof(T)];
+		std::atomic<Slot*> next;
+	};
+
+	struct TaggedSlot
+	{
+		Slot *ptr;
+		std::uintptr_t tag;
+	};
+
+	struct Chunk
+	{
+		Slot slots[CHUNK_SIZE];
+		Chunk *next;
+	};
+
+	// Only the owning thread writes, Stats() reads from anywhere
+	struct alignas(64) Cache
+	{
+		Slot *items[CACHE_SIZE];
+		unsigned count = 0;
+		std::atomic<std::uint64_t> acquires{0};
+		std::atomic<std::uint64_t> cacheHits{0};
+		std::atomic<std::uint64_t> sharedHits{0};
+	};
+
+	std::atomic<TaggedSlot> freeList;
+	std::atomic<Chunk*> chunks{nullptr};
+	std::atomic<std::uint64_t> slots{0};
+	Cache caches[MAX_POOL_THREADS];
+	Cache uncached;
+
+	static void Bump(std::atomic<std::uint64_t>& counter, bool owned);
+
+	Slot* PopShared();
+	void PushShared(Slot *first, Slot *last);
+	Slot* Carve(Cache *cache);
+	Slot* AcquireSlot();
+	void ReleaseSlot(Slot *slot);
+public:
+	class Releaser
+	{
+		ObjectPool *pool;
+	public:
+		explicit Releaser(ObjectPool *pool_ = nullptr) : pool(pool_) {}
+
+		void operator()(T *p) const
+		{
+			pool->release(p);
+		}
+	};
+
+	typedef std::unique_ptr<T, Releaser> Handle;
+
+	ObjectPool();
+	ObjectPool(ObjectPool const&) = delete;
+	ObjectPool& operator=(ObjectPool const&) = delete;
+	~ObjectPool();
+
+	template <typename... Args>
+	T* acquire(Args&&... args);
+	void release(T *p);
+
+	template <typename... Args>
+	Handle make_handle(Args&&... args);
+
+	PoolStats Stats() const;
+};
+
+template <typename T>
+ObjectPool<T>::ObjectPool()
+{
+	freeList.store(TaggedSlot{nullptr, 0});
+}
+
+// Every object must have been released by now
+template <typename T>
+ObjectPool<T>::~ObjectPool()
+{
+	Chunk *chunk = chunks.load();
+	while(chunk)
+	{
+		Chunk *const next = chunk->next;
+		delete chunk;
+		chunk = next;
+	}
+}
+
+template <typename T>
+void ObjectPool<T>::Bump(std::atomic<std::uint64_t>& counter, bool owned)
+{
+	if(owned)
+		counter.store(counter.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+	else
+		counter.fetch_add(1, std::memory_order_relaxed);
+}
+
+template <typename T>
+typename ObjectPool<T>::Slot* ObjectPool<T>::PopShared()
+{
+	TaggedSlot oldHead = freeList.load(std::memory_order_acquire);
+	TaggedSlot newHead;
+	do
+	{
+		if(!oldHead.ptr)
+			return nullptr;
+		newHead.ptr = oldHead.ptr->next.load(std::memory_order_relaxed);
+		newHead.tag = oldHead.tag + 1;
+	}
+	while(!freeList.compare_exchange_weak(oldHead, newHead,
+										  std::memory_order_acquire, std::memory_order_acquire))
+		;
+	return oldHead.ptr;
+}
+
+// Splices a chain already linked through next with a single CAS
+template <typename T>
+void ObjectPool<T>::PushShared(Slot *first, Slot *last)
+{
+	TaggedSlot oldHead = freeList.load(std::memory_order_relaxed);
+	TaggedSlot newHead;
+	do
+	{
+		last->next.store(oldHead.ptr, std::memory_order_relaxed);
+		newHead.ptr = first;
+		newHead.tag = oldHead.tag + 1;
+	}
+	while(!freeList.compare_exchange_weak(oldHead, newHead,
+										  std::memory_order_release, std::memory_order_relaxed))
+		;
+}
+
+// Takes a fresh chunk from the heap: one slot for the caller, as many as fit
+// into the thread cache, the rest goes to the shared list
+template <typename T>
+typename ObjectPool<T>::Slot* ObjectPool<T>::Carve(Cache *cache)
+{
+	Chunk *const chunk = new Chunk;
+	chunk->next = chunks.load(std::memory_order_relaxed);
+	while(!chunks.compare_exchange_weak(chunk->next, chunk))
+		;
+	slots.fetch_add(CHUNK_SIZE, std::memory_order_relaxed);
+
+	unsigned i = 1;
+	if(cache)
+	{
+		for(; i < CHUNK_SIZE && cache->count < CACHE_SIZE; i++)
+			cache->items[cache->count++] = &chunk->slots[i];
+	}
+	if(i < CHUNK_SIZE)
+	{
+		for(unsigned j = i; j + 1 < CHUNK_SIZE; j++)
+			chunk->slots[j].next.store(&chunk->slots[j + 1], std::memory_order_relaxed);
+		PushShared(&chunk->slots[i], &chunk->slots[CHUNK_SIZE - 1]);
+	}
+	return &chunk->slots[0];
+}
+
+template <typename T>
+typename ObjectPool<T>::Slot* ObjectPool<T>::AcquireSlot()
+{
+	unsigned const index = GetPoolThreadIndex();
+	bool const owned = index != NO_POOL_THREAD;
+	Cache &cache = owned ? caches[index] : uncached;
+
+	Bump(cache.acquires, owned);
+	if(owned && cache.count)
+	{
+		Bump(cache.cacheHits, owned);
+		return cache.items[--cache.count];
+	}
+	if(Slot *const slot = PopShared())
+	{
+		Bump(cache.sharedHits, owned);
+		return slot;
+	}
+	return Carve(owned ? &cache : nullptr);
+}
+
+// A full cache hands half of its slots to the shared list in one CAS
+template <typename T>
+void ObjectPool<T>::ReleaseSlot(Slot *slot)
+{
+	unsigned const index = GetPoolThreadIndex();
+	if(index == NO_POOL_THREAD)
+	{
+		PushShared(slot, slot);
+		return;
+	}
+
+	Cache &cache = caches[index];
+	if(cache.count == CACHE_SIZE)
+	{
+		unsigned const keep = CACHE_SIZE / 2;
+		for(unsigned i = keep; i + 1 < CACHE_SIZE; i++)
+			cache.items[i]->next.store(cache.items[i + 1], std::memory_order_relaxed);
+		PushShared(cache.items[keep], cache.items[CACHE_SIZE - 1]);
+		cache.count = keep;
+	}
+	cache.items[cache.count++] = slot;
+}
+
+template <typename T>
+template <typename... Args>
+T* ObjectPool<T>::acquire(Args&&... args)
+{
+	Slot *const slot = AcquireSlot();
+	try
+	{
+		return new (slot->storage) T(std::forward<Args>(args)...);
+	}
+	catch(...)
+	{
+		ReleaseSlot(slot);
+		throw;
+	}
+}
+
+template <typename T>
+void ObjectPool<T>::release(T *p)
+{
+	if(!p)
+		return;
+	p->~T();
+	ReleaseSlot(reinterpret_cast<Slot*>(reinterpret_cast<unsigned char*>(p)));
+}
+
+template <typename T>
+template <typename... Args>
+typename ObjectPool<T>::Handle ObjectPool<T>::make_handle(Args&&... args)
+{
+	return Handle(acquire(std::forward<Args>(args)...), Releaser(this));
+}
+
+template <typename T>
+PoolStats ObjectPool<T>::Stats() const
+{
+	PoolStats stats = {};
+	for(unsigned i = 0; i <= MAX_POOL_THREADS; i++)
+	{
+		Cache const &cache = i < MAX_POOL_THREADS ? caches[i] : uncached;
+		stats.acquires += cache.acquires.load(std::memory_order_relaxed);
+		stats.cacheHits += cache.cacheHits.load(std::memory_order_relaxed);
+		stats.sharedHits += cache.sharedHits.load(std::memory_order_relaxed);
+	}
+	stats.highWaterMark = slots.load(std::memory_order_relaxed);
+	return stats;
+}
@@ -1,11 +1,34 @@
 #include "stdafx.h"
 
+#include <iostream>
 #include <memory>
 #include <atomic>
+#include <thread>
+#include <vector>
+#include <chrono>
+
+#include "../../eventcount.h"
+#include "../../arena.h"
 
 using namespace std;
 
-template <typename T>
+struct SeqCstOrdering
+{
+	static constexpr memory_order relaxed = memory_order::memory_order_seq_cst;
+	static constexpr memory_order acquire = memory_order::memory_order_seq_cst;
+	static constexpr memory_order release = memory_order::memory_order_seq_cst;
+	static constexpr memory_order acq_rel = memory_order::memory_order_seq_cst;
+};
+
+struct MinimalOrdering
+{
+	static constexpr memory_order relaxed = memory_order::memory_order_relaxed;
+	static constexpr memory_order acquire = memory_order::memory_order_acquire;
+	static constexpr memory_order release = memory_order::memory_order_release;
+	static constexpr memory_order acq_rel = memory_order::memory_order_acq_rel;
+};
+
+template <typename T, typename Ordering = MinimalOrdering, typename Allocator = HeapAllocator>
 class LFQueueRCTailHelpingThread
 {
 private:
@@ -18,13 +41,14 @@ private:
 
 	atomic<CountedNodePtr> head;
 	atomic<CountedNodePtr> tail;
+	EventCount nonEmpty;
 
 	struct NodeCounter {
 		unsigned internalCount : 30;
 		unsigned externalCounters : 2;
 	};
 
-	struct Node
+	struct Node : AllocatedBy<Allocator>
 	{
 		atomic<T*> data;
 		atomic<NodeCounter> count;
@@ -35,21 +59,30 @@ private:
 			NodeCounter newCount;
 			newCount.internalCount = 0;
 			newCount.externalCounters = 2;
-			count.store(newCount);
+			count.store(newCount, Ordering::relaxed);
+
+			CountedNodePtr newNext = { 0 };
+			next.store(newNext, Ordering::relaxed);
+
+			data.store(nullptr, Ordering::relaxed);
 		}
 
 		void ReleaseRef()
 		{
-			NodeCounter oldCounter = count.load();
+			NodeCounter oldCounter = count.load(Ordering::relaxed);
 			NodeCounter newCounter;
 			do
 			{
 				newCounter = oldCounter;
 				--newCounter.internalCount;
-			} while (!count.compare_exchange_strong(oldCounter, newCounter))
+			} while (!count.compare_exchange_strong(oldCounter, newCounter,
+													Ordering::release, Ordering::relaxed))
 				;
 			if (!newCounter.internalCount && !newCounter.externalCounters)
+			{
+				count.load(Ordering::acquire);
 				delete this;
+			}
 		}
 	};
 
@@ -59,7 +92,8 @@ private:
 	void SetNewTail(CountedNodePtr &oldTail, CountedNodePtr const &newTail)
 	{
 		Node * const currentTailPtr = oldTail.ptr;
-		while (!tail.compare_exchange_weak(oldTail, newTail) && oldTail.ptr == currentTailPtr)
+		while (!tail.compare_exchange_weak(oldTail, newTail, Ordering::release, Ordering::relaxed) &&
+			   oldTail.ptr == currentTailPtr)
 			;
 		if (oldTail.ptr == currentTailPtr)
 			FreeExternalCounter(oldTail);
@@ -68,58 +102,95 @@ private:
 	}
 
 public:
+	LFQueueRCTailHelpingThread();
+	~LFQueueRCTailHelpingThread();
+
 	void push(T newValue);
 	unique_ptr<T> pop();
+	unique_ptr<T> wait_pop();
+	template <typename Rep, typename Period>
+	unique_ptr<T> wait_pop_for(chrono::duration<Rep, Period> const& timeout);
 };
 
-template <typename T>
-void LFQueueRCTailHelpingThread<T>::IncreaseExternalCounter(atomic<CountedNodePtr>& counter, CountedNodePtr& old_counter)
+template <typename T, typename Ordering, typename Allocator>
+LFQueueRCTailHelpingThread<T, Ordering, Allocator>::LFQueueRCTailHelpingThread()
+{
+	CountedNodePtr dummy;
+	dummy.externalCount = 1;
+	dummy.ptr = new Node;
+
+	head.store(dummy);
+	tail.store(head.load());
+}
+
+template <typename T, typename Ordering, typename Allocator>
+LFQueueRCTailHelpingThread<T, Ordering, Allocator>::~LFQueueRCTailHelpingThread()
+{
+	CountedNodePtr current = head.load();
+	while (current.ptr) {
+		T* data = current.ptr->data.load();
+		if (data)
+			delete data;
+
+		current = current.ptr->next.load();
+	}
+}
+
+template <typename T, typename Ordering, typename Allocator>
+void LFQueueRCTailHelpingThread<T, Ordering, Allocator>::IncreaseExternalCounter(atomic<CountedNodePtr>& counter, CountedNodePtr& old_counter)
 {
 	CountedNodePtr new_counter;
 	do
 	{
 		new_counter = old_counter;
 		++new_counter.externalCount;
-	} while (!counter.compare_exchange_strong(old_counter, new_counter))
+	} while (!counter.compare_exchange_strong(old_counter, new_counter,
+											  Ordering::acquire, Ordering::relaxed))
 		;
 	old_counter.externalCount = new_counter.externalCount;
 }
 
-template <typename T>
-void LFQueueRCTailHelpingThread<T>::FreeExternalCounter(CountedNodePtr& oldNodePtr)
+template <typename T, typename Ordering, typename Allocator>
+void LFQueueRCTailHelpingThread<T, Ordering, Allocator>::FreeExternalCounter(CountedNodePtr& oldNodePtr)
 {
 	Node* const ptr = oldNodePtr.ptr;
 	int const countIncrease = oldNodePtr.externalCount - 2;
-	NodeCounter oldCounter = ptr->count.load();
+	NodeCounter oldCounter = ptr->count.load(Ordering::relaxed);
 	NodeCounter newCounter;
 	do
 	{
 		newCounter = oldCounter;
 		--newCounter.externalCounters;
 		newCounter.internalCount += countIncrease;
-	} while (!ptr->count.compare_exchange_strong(oldCounter, newCounter))
+	} while (!ptr->count.compare_exchange_strong(oldCounter, newCounter,
+												 Ordering::release, Ordering::relaxed))
 		;
 	if (!newCounter.internalCount && !newCounter.externalCounters)
+	{
+		ptr->count.load(Ordering::acquire);
 		delete ptr;
+	}
 }
 
-template <typename T>
-void LFQueueRCTailHelpingThread<T>::push(T newValue)
+template <typename T, typename Ordering, typename Allocator>
+void LFQueueRCTailHelpingThread<T, Ordering, Allocator>::push(T newValue)
 {
 	unique_ptr<T> newData(new T(newValue));
 	CountedNodePtr newNext;
 	newNext.ptr = new Node;
 	newNext.externalCount = 1;
-	CountedNodePtr oldTail = tail.load();
+	CountedNodePtr oldTail = tail.load(Ordering::relaxed);
 
 	for (;;) {
 		IncreaseExternalCounter(tail, oldTail);
 		T* oldData = nullptr;
 
-		if (oldTail.ptr->data.compare_exchange_strong(oldData, newData.get()))
+		if (oldTail.ptr->data.compare_exchange_strong(oldData, newData.get(),
+													  Ordering::release, Ordering::relaxed))
 		{
 			CountedNodePtr oldNext = { 0 };
-			if (!oldTail.ptr->next.compare_exchange_strong(oldNext, newNext))
+			if (!oldTail.ptr->next.compare_exchange_strong(oldNext, newNext,
+														   Ordering::acq_rel, Ordering::acquire))
 			{
 				delete newNext.ptr;
 				newNext = oldNext;
@@ -131,7 +202,8 @@ void LFQueueRCTailHelpingThread<T>::push(T newValue)
 		else
 		{
 			CountedNodePtr oldNext = { 0 };
-			if (oldTail.ptr->next.compare_exchange_strong(oldNext, newNext))
+			if (oldTail.ptr->next.compare_exchange_strong(oldNext, newNext,
+														  Ordering::acq_rel, Ordering::acquire))
 			{
 				oldNext = newNext;
 				newNext.ptr = new Node;
@@ -139,22 +211,24 @@ void LFQueueRCTailHelpingThread<T>::push(T newValue)
 			SetNewTail(oldTail, oldNext);
 		}
 	}
+	nonEmpty.notify_one();
 }
 
-template <typename T>
-std::unique_ptr<T> LFQueueRCTailHelpingThread<T>::pop()
+template <typename T, typename Ordering, typename Allocator>
+std::unique_ptr<T> LFQueueRCTailHelpingThread<T, Ordering, Allocator>::pop()
 {
-	CountedNodePtr oldHead = head.load();
+	CountedNodePtr oldHead = head.load(Ordering::relaxed);
 	for (;;) {
 		IncreaseExternalCounter(head, oldHead);
 		Node* const ptr = oldHead.ptr;
-		if (ptr == tail.load().ptr) {
+		if (ptr == tail.load(Ordering::acquire).ptr) {
+			ptr->ReleaseRef();
 			return unique_ptr<T>();
 		}
 
-		CountedNodePtr next = ptr->next.load();
-		if (head.compare_exchange_strong(oldHead, next)) {
-			T* const res = ptr->data.exchange(nullptr);
+		CountedNodePtr next = ptr->next.load(Ordering::acquire);
+		if (head.compare_exchange_strong(oldHead, next, Ordering::release, Ordering::relaxed)) {
+			T* const res = ptr->data.load(Ordering::acquire);
 			FreeExternalCounter(oldHead);
 			return unique_ptr<T>(res);
 		}
@@ -162,6 +236,44 @@ std::unique_ptr<T> LFQueueRCTailHelpingThread<T>::pop()
 	}
 }
 
+template <typename T, typename Ordering, typename Allocator>
+std::unique_ptr<T> LFQueueRCTailHelpingThread<T, Ordering, Allocator>::wait_pop()
+{
+	return WaitPop(nonEmpty, [this] { return pop(); });
+}
+
+template <typename T, typename Ordering, typename Allocator>
+template <typename Rep, typename Period>
+std::unique_ptr<T> LFQueueRCTailHelpingThread<T, Ordering, Allocator>::wait_pop_for(chrono::duration<Rep, Period> const& timeout)
+{
+	return WaitPopFor(nonEmpty, [this] { return pop(); }, timeout);
+}
+
+template <typename Ordering>
+double Benchmark(unsigned threadsCount, int operations)
+{
+	LFQueueRCTailHelpingThread<int, Ordering> queue;
+	vector<thread> threads;
+
+	auto const start = chrono::steady_clock::now();
+	for (unsigned t = 0; t < threadsCount; t++)
+	{
+		threads.emplace_back([&]
+		{
+			for (int i = 0; i < operations; i++)
+			{
+				queue.push(i);
+				queue.pop();
+			}
+		});
+	}
+	for (thread& t : threads)
+		t.join();
+	chrono::duration<double> const elapsed = chrono::steady_clock::now() - start;
+
+	return threadsCount * operations / elapsed.count();
+}
+
 int main()
 {
 	LFQueueRCTailHelpingThread<int> v;
@@ -170,5 +282,20 @@ int main()
 
 	auto t = v.pop();
 
+	thread consumer([&] { cout << "wait_pop: " << *v.wait_pop() << endl; });
+	this_thread::sleep_for(chrono::milliseconds(10));
+	v.push(20);
+	consumer.join();
+	cout << "wait_pop_for: " << (v.wait_pop_for(chrono::milliseconds(10)) ? "value" : "timeout") << endl;
+
+	unsigned const threadsCount = 4;
+	int const operations = 200000;
+	double const seqCst = Benchmark<SeqCstOrdering>(threadsCount, operations);
+	double const minimal = Benchmark<MinimalOrdering>(threadsCount, operations);
+
+	cout << "seq_cst: " << seqCst << " push+pop/s" << endl;
+	cout << "minimal: " << minimal << " push+pop/s" << endl;
+	cout << "gain:    " << (minimal / seqCst - 1) * 100 << "%" << endl;
+
 	return 0;
-}
\ No newline at end of file
+}
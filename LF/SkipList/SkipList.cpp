@@ -0,0 +1,222 @@
+#include "stdafx.h"
+#include <iostream>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <chrono>
+#include <random>
+#include <map>
+
+#include "skip_list.h"
+
+using namespace std;
+
+template <typename K, typename V>
+class MutexMap
+{
+	mutex m;
+	map<K, V> data;
+public:
+	bool insert(K const& key, V const& value)
+	{
+		lock_guard<mutex> lock(m);
+		return data.emplace(key, value).second;
+	}
+
+	bool find(K const& key, V& value)
+	{
+		lock_guard<mutex> lock(m);
+		auto const it = data.find(key);
+		if(it == data.end())
+			return false;
+		value = it->second;
+		return true;
+	}
+
+	bool erase(K const& key)
+	{
+		lock_guard<mutex> lock(m);
+		return data.erase(key) != 0;
+	}
+
+	bool pop_min(K& key, V& value)
+	{
+		lock_guard<mutex> lock(m);
+		if(data.empty())
+			return false;
+		key = data.begin()->first;
+		value = data.begin()->second;
+		data.erase(data.begin());
+		return true;
+	}
+};
+
+// Lookup heavy mix: 80% find, 10% insert, 10% erase over a fixed key range
+template <typename Map>
+double MapBenchmark(unsigned threadsCount, int operations, int keys)
+{
+	Map map;
+	for(int k = 0; k < keys; k += 2)
+		map.insert(k, k);
+
+	vector<thread> threads;
+	auto const start = chrono::steady_clock::now();
+	for(unsigned t = 0; t < threadsCount; t++)
+	{
+		threads.emplace_back([&, t]
+		{
+			mt19937 random(t);
+			uniform_int_distribution<int> keyOf(0, keys - 1);
+			uniform_int_distribution<int> operationOf(0, 9);
+			int value;
+			for(int i = 0; i < operations; i++)
+			{
+				int const key = keyOf(random);
+				int const operation = operationOf(random);
+				if(operation == 0)
+					map.insert(key, key);
+				else if(operation == 1)
+					map.erase(key);
+				else
+					map.find(key, value);
+			}
+		});
+	}
+	for(thread& t : threads)
+		t.join();
+	chrono::duration<double> const elapsed = chrono::steady_clock::now() - start;
+
+	return threadsCount * operations / elapsed.count();
+}
+
+// Priority queue use: every thread alternates insert of a random priority
+// and pop_min, on top of a preloaded backlog
+template <typename Map>
+double QueueBenchmark(unsigned threadsCount, int operations, int backlog)
+{
+	Map map;
+	mt19937 seed(42);
+	for(int i = 0; i < backlog; i++)
+		map.insert(static_cast<int>(seed()), i);
+
+	vector<thread> threads;
+	auto const start = chrono::steady_clock::now();
+	for(unsigned t = 0; t < threadsCount; t++)
+	{
+		threads.emplace_back([&, t]
+		{
+			mt19937 random(t + 1);
+			int key, value;
+			for(int i = 0; i < operations; i += 2)
+			{
+				map.insert(static_cast<int>(random()), i);
+				map.pop_min(key, value);
+			}
+		});
+	}
+	for(thread& t : threads)
+		t.join();
+	chrono::duration<double> const elapsed = chrono::steady_clock::now() - start;
+
+	return threadsCount * operations / elapsed.count();
+}
+
+// Every thread inserts its own keys and removes them again, half with
+// erase and half with pop_min, which may take any thread's key. Each key
+// must be removed exactly once and the list must end up empty.
+bool Stress(unsigned threadsCount, int rounds)
+{
+	LFSkipList<int, int> list;
+	vector<atomic<int>> removed(threadsCount * rounds);
+	for(atomic<int>& r : removed)
+		r.store(0);
+	atomic<bool> ok(true);
+
+	auto take = [&](int key)
+	{
+		if(removed[key].fetch_add(1) != 0)
+			ok.store(false);
+	};
+
+	vector<thread> threads;
+	for(unsigned t = 0; t < threadsCount; t++)
+	{
+		threads.emplace_back([&, t]
+		{
+			int key, value;
+			for(int i = 0; i < rounds; i++)
+			{
+				int const mine = i * threadsCount + t;
+				list.insert(mine, mine);
+				if(i % 2)
+				{
+					if(list.erase(mine))
+						take(mine);
+				}
+				else if(list.pop_min(key, value))
+				{
+					take(key);
+				}
+			}
+		});
+	}
+	for(thread& t : threads)
+		t.join();
+
+	int key, value;
+	while(list.pop_min(key, value))
+		take(key);
+	for(atomic<int>& r : removed)
+		if(r.load() != 1)
+			ok.store(false);
+	return ok.load() && list.size() == 0;
+}
+
+int main()
+{
+	LFSkipList<int, int> list;
+
+	for(int i = 20; i > 0; i--)
+		list.insert(i, i * i);
+	list.erase(7);
+
+	int value = 0;
+	cout << "find 9: " << (list.find(9, value) ? value : -1) << endl;
+	cout << "find 7: " << (list.find(7, value) ? value : -1) << endl;
+	cout << "[5, 10):";
+	list.for_each(5, 10, [](int key, int) { cout << " " << key; });
+	cout << endl;
+	cout << "pop_min:";
+	int key;
+	for(int i = 0; i < 3 && list.pop_min(key, value); i++)
+		cout << " " << key;
+	cout << endl;
+	cout << "size: " << list.size() << endl;
+	cout << endl;
+
+	cout << "erase/pop_min stress, 8 threads: " << (Stress(8, 200000) ? "ok" : "FAILED") << endl;
+	cout << endl;
+
+	int const operations = 500000;
+	int const keys = 100000;
+	unsigned const threadCounts[] = {1, 2, 4, 8};
+
+	cout << "ops/s, 80% find / 10% insert / 10% erase\n";
+	for(unsigned threadsCount : threadCounts)
+	{
+		cout << threadsCount << " threads\n";
+		cout << "  skip list: " << MapBenchmark<LFSkipList<int, int>>(threadsCount, operations, keys) << endl;
+		cout << "  mutex map: " << MapBenchmark<MutexMap<int, int>>(threadsCount, operations, keys) << endl;
+	}
+
+	cout << "ops/s, insert + pop_min\n";
+	for(unsigned threadsCount : threadCounts)
+	{
+		cout << threadsCount << " threads\n";
+		cout << "  skip list: " << QueueBenchmark<LFSkipList<int, int>>(threadsCount, operations, keys) << endl;
+		cout << "  mutex map: " << QueueBenchmark<MutexMap<int, int>>(threadsCount, operations, keys) << endl;
+	}
+
+	return 0;
+}
@@ -0,0 +1,502 @@
+#pragma once
+
+#include <atomic>
+#include <functional>
+#include <new>
+#include <cstddef>
+#include <cstdint>
+
+#include "../Stack/ReclamationPolicy/lf_stack.h"
+
+// Lock-free skip list (Herlihy & Shavit, after Fraser), an ordered map that
+// doubles as a concurrent priority queue through pop_min.
+//
+// Every level is a sorted list with marked next pointers, as in Michael's
+// list. A node is erased by marking its next pointers from the top level
+// down; whoever marks level 0 has removed it. Marked nodes are unlinked by
+// any thread that walks past them.
+//
+// Every operation runs inside an epoch of lf_stack.h. A node unlinked from
+// all of its levels is retired and freed two epochs later, so a walk may
+// keep following a node it loaded even after the node is unlinked. An
+// insert that is still linking upper levels can relink a node erased in the
+// meantime, so the inserting and the erasing thread each own the node: the
+// last one to let go purges it from every level and retires it.
+template <typename K, typename V, typename Compare = std::less<K>>
+class LFSkipList
+{
+private:
+	static int const MAX_LEVEL = 16;
+
+	// Allocated with room for exactly topLevel next pointers, most nodes
+	// only have one or two levels
+	struct Node
+	{
+		K key;
+		V value;
+		int topLevel;
+		std::atomic<int> owners;
+		unsigned retiredEpoch;
+		Node *retiredNext;
+		std::atomic<Node*> next[1];
+
+		Node(K const& key_, V const& value_, int topLevel_, int owners_) :
+			key(key_), value(value_), topLevel(topLevel_), owners(owners_), retiredEpoch(0), retiredNext(nullptr)
+		{}
+	};
+
+	// Marks the current thread as inside an operation for the lifetime of
+	// the guard, like EpochReclaimer's Guard
+	class EpochGuard
+	{
+		EpochRecord& record;
+	public:
+		EpochGuard();
+		EpochGuard(EpochGuard const&) = delete;
+		EpochGuard& operator=(EpochGuard const&) = delete;
+		~EpochGuard();
+	};
+
+	Node *const head;
+	std::atomic<Node*> retired;
+	std::atomic<unsigned> collectedEpoch;
+	std::atomic<std::size_t> count;
+	Compare less;
+
+	static Node* Marked(Node *p)
+	{
+		return reinterpret_cast<Node*>(reinterpret_cast<std::uintptr_t>(p) | 1);
+	}
+
+	static Node* Unmarked(Node *p)
+	{
+		return reinterpret_cast<Node*>(reinterpret_cast<std::uintptr_t>(p) & ~std::uintptr_t(1));
+	}
+
+	static bool IsMarked(Node *p)
+	{
+		return reinterpret_cast<std::uintptr_t>(p) & 1;
+	}
+
+	static Node* NewNode(K const& key, V const& value, int topLevel, int owners);
+	static void DeleteNode(Node *node);
+	static int RandomLevel();
+
+	bool Find(K const& key, Node **preds, Node **succs);
+	void Purge(K const& key);
+	static bool Remove(Node *node);
+	bool Release(Node *node);
+	void Collect();
+public:
+	LFSkipList();
+	LFSkipList(LFSkipList const&) = delete;
+	LFSkipList& operator=(LFSkipList const&) = delete;
+	~LFSkipList();
+
+	bool insert(K const& key, V const& value);
+	bool find(K const& key, V& value);
+	bool erase(K const& key);
+	bool pop_min(K& key, V& value);
+	std::size_t size() const;
+
+	// Calls f(key, value) for the entries in [from, to) in key order. Entries
+	// inserted or erased during the walk may or may not be seen.
+	template <typename F>
+	void for_each(K const& from, K const& to, F f);
+};
+
+template <typename K, typename V, typename Compare>
+LFSkipList<K, V, Compare>::EpochGuard::EpochGuard() : record(GetEpochRecordForCurrentThread())
+{
+	unsigned epoch;
+	record.active.store(true);
+	do
+	{
+		epoch = GetGlobalEpoch().load();
+		record.epoch.store(epoch);
+	}
+	while(epoch != GetGlobalEpoch().load())
+		;
+}
+
+template <typename K, typename V, typename Compare>
+LFSkipList<K, V, Compare>::EpochGuard::~EpochGuard()
+{
+	record.active.store(false);
+}
+
+template <typename K, typename V, typename Compare>
+LFSkipList<K, V, Compare>::LFSkipList() :
+	head(NewNode(K(), V(), MAX_LEVEL, 1)), retired(nullptr), collectedEpoch(0), count(0)
+{}
+
+template <typename K, typename V, typename Compare>
+LFSkipList<K, V, Compare>::~LFSkipList()
+{
+	Node *n = head;
+	while(n)
+	{
+		Node *const next = Unmarked(n->next[0].load());
+		DeleteNode(n);
+		n = next;
+	}
+	n = retired.exchange(nullptr);
+	while(n)
+	{
+		Node *const next = n->retiredNext;
+		DeleteNode(n);
+		n = next;
+	}
+}
+
+template <typename K, typename V, typename Compare>
+typename LFSkipList<K, V, Compare>::Node* LFSkipList<K, V, Compare>::NewNode(K const& key, V const& value, int topLevel, int owners)
+{
+	void *const p = ::operator new(sizeof(Node) + (topLevel - 1) * sizeof(std::atomic<Node*>));
+	Node *const node = new(p) Node(key, value, topLevel, owners);
+	for(int i = 0; i < topLevel; i++)
+		new(&node->next[i]) std::atomic<Node*>(nullptr);
+	return node;
+}
+
+template <typename K, typename V, typename Compare>
+void LFSkipList<K, V, Compare>::DeleteNode(Node *node)
+{
+	node->~Node();
+	::operator delete(node);
+}
+
+// Level k + 1 with probability 2^-(k + 1)
+template <typename K, typename V, typename Compare>
+int LFSkipList<K, V, Compare>::RandomLevel()
+{
+	thread_local static std::uint64_t state = reinterpret_cast<std::uintptr_t>(&state) | 1;
+	state ^= state << 13;
+	state ^= state >> 7;
+	state ^= state << 17;
+	return LowestSetBit(state | (std::uint64_t(1) << (MAX_LEVEL - 1))) + 1;
+}
+
+// preds[i] is the last node before key on level i, succs[i] the first live
+// node not before it. Marked nodes met on the way are unlinked.
+template <typename K, typename V, typename Compare>
+bool LFSkipList<K, V, Compare>::Find(K const& key, Node **preds, Node **succs)
+{
+retry:
+	Node *pred = head;
+	for(int level = MAX_LEVEL - 1; level >= 0; level--)
+	{
+		Node *curr = Unmarked(pred->next[level].load());
+		for(;;)
+		{
+			if(!curr)
+				break;
+
+			Node *const next = curr->next[level].load();
+			if(IsMarked(next))
+			{
+				Node *expected = curr;
+				if(!pred->next[level].compare_exchange_strong(expected, Unmarked(next)))
+					goto retry;
+				curr = Unmarked(next);
+				continue;
+			}
+
+			if(!less(curr->key, key))
+				break;
+			pred = curr;
+			curr = next;
+		}
+		preds[level] = pred;
+		succs[level] = curr;
+	}
+	return succs[0] && !less(key, succs[0]->key);
+}
+
+// Find stops at the first live node with the key, so a marked node relinked
+// behind a newer node with the same key is swept here
+template <typename K, typename V, typename Compare>
+void LFSkipList<K, V, Compare>::Purge(K const& key)
+{
+	Node *preds[MAX_LEVEL];
+	Node *succs[MAX_LEVEL];
+
+retry:
+	Find(key, preds, succs);
+	for(int level = MAX_LEVEL - 1; level >= 0; level--)
+	{
+		Node *pred = succs[level];
+		while(pred)
+		{
+			Node *const curr = Unmarked(pred->next[level].load());
+			if(!curr || less(key, curr->key))
+				break;
+
+			Node *const next = curr->next[level].load();
+			if(IsMarked(next))
+			{
+				Node *expected = curr;
+				if(!pred->next[level].compare_exchange_strong(expected, Unmarked(next)))
+					goto retry;
+				continue;
+			}
+			pred = curr;
+		}
+	}
+}
+
+// Marks every level of the node, true for the thread whose mark on level 0
+// removed it
+template <typename K, typename V, typename Compare>
+bool LFSkipList<K, V, Compare>::Remove(Node *node)
+{
+	for(int level = node->topLevel - 1; level > 0; level--)
+	{
+		Node *next = node->next[level].load();
+		while(!IsMarked(next) && !node->next[level].compare_exchange_weak(next, Marked(next)))
+			;
+	}
+
+	Node *next = node->next[0].load();
+	while(!IsMarked(next))
+	{
+		if(node->next[0].compare_exchange_weak(next, Marked(next)))
+			return true;
+	}
+	return false;
+}
+
+// Drops one owner of an unlinked node, true when it was the last one and the
+// node got retired
+template <typename K, typename V, typename Compare>
+bool LFSkipList<K, V, Compare>::Release(Node *node)
+{
+	if(node->owners.fetch_sub(1) != 1)
+		return false;
+
+	node->retiredEpoch = GetGlobalEpoch().load();
+	node->retiredNext = retired.load();
+	while(!retired.compare_exchange_weak(node->retiredNext, node))
+		;
+	return true;
+}
+
+// Frees retired nodes that are two epochs old, called outside of an epoch.
+// Nothing new can expire while the epoch stands still, so the retired list
+// is scanned by one thread per epoch only; a thread preempted inside an
+// operation then does not turn every erase into a walk of a growing list.
+template <typename K, typename V, typename Compare>
+void LFSkipList<K, V, Compare>::Collect()
+{
+	TryAdvanceEpoch();
+
+	unsigned const current = GetGlobalEpoch().load();
+	unsigned collected = collectedEpoch.load(std::memory_order_relaxed);
+	if(collected == current || !collectedEpoch.compare_exchange_strong(collected, current, std::memory_order_relaxed))
+		return;
+
+	Node *n = retired.exchange(nullptr);
+	Node *keepFirst = nullptr;
+	Node *keepLast = nullptr;
+	while(n)
+	{
+		Node *const next = n->retiredNext;
+		// Signed: a node retired after current was read may carry
+		// current + 1, which must not wrap around into "old enough"
+		if(static_cast<int>(current - n->retiredEpoch) >= 2)
+			DeleteNode(n);
+		else
+		{
+			n->retiredNext = keepFirst;
+			keepFirst = n;
+			if(!keepLast)
+				keepLast = n;
+		}
+		n = next;
+	}
+
+	if(keepFirst)
+	{
+		keepLast->retiredNext = retired.load();
+		while(!retired.compare_exchange_weak(keepLast->retiredNext, keepFirst))
+			;
+	}
+}
+
+// false when the key is already there, the stored value is left as is
+template <typename K, typename V, typename Compare>
+bool LFSkipList<K, V, Compare>::insert(K const& key, V const& value)
+{
+	int const topLevel = RandomLevel();
+	Node *preds[MAX_LEVEL];
+	Node *succs[MAX_LEVEL];
+	Node *node = nullptr;
+	bool collect = false;
+	{
+		EpochGuard guard;
+		for(;;)
+		{
+			if(Find(key, preds, succs))
+			{
+				if(node)
+					DeleteNode(node);
+				return false;
+			}
+
+			if(!node)
+				node = NewNode(key, value, topLevel, 2);
+			for(int level = 0; level < topLevel; level++)
+				node->next[level].store(succs[level], std::memory_order_relaxed);
+
+			Node *expected = succs[0];
+			if(preds[0]->next[0].compare_exchange_strong(expected, node))
+				break;
+		}
+		count.fetch_add(1, std::memory_order_relaxed);
+
+		// Upper levels are only shortcuts, linking stops as soon as the node
+		// is being erased
+		for(int level = 1; level < topLevel; level++)
+		{
+			for(;;)
+			{
+				Node *next = node->next[level].load();
+				if(IsMarked(next))
+					goto linked;
+				if(next != succs[level] && !node->next[level].compare_exchange_strong(next, succs[level]))
+					goto linked;
+
+				Node *expected = succs[level];
+				if(preds[level]->next[level].compare_exchange_strong(expected, node))
+					break;
+
+				Find(key, preds, succs);
+				if(succs[0] != node)
+					goto linked;
+			}
+		}
+linked:
+		if(IsMarked(node->next[0].load()))
+			Purge(key);
+		collect = Release(node);
+	}
+	if(collect)
+		Collect();
+	return true;
+}
+
+// Read only walk, marked nodes are stepped over but not unlinked
+template <typename K, typename V, typename Compare>
+bool LFSkipList<K, V, Compare>::find(K const& key, V& value)
+{
+	EpochGuard guard;
+	Node *pred = head;
+	Node *curr = nullptr;
+	for(int level = MAX_LEVEL - 1; level >= 0; level--)
+	{
+		curr = Unmarked(pred->next[level].load(std::memory_order_acquire));
+		while(curr)
+		{
+			Node *const next = curr->next[level].load(std::memory_order_acquire);
+			if(IsMarked(next))
+			{
+				curr = Unmarked(next);
+				continue;
+			}
+			if(!less(curr->key, key))
+				break;
+			pred = curr;
+			curr = next;
+		}
+	}
+
+	if(!curr || less(key, curr->key))
+		return false;
+	value = curr->value;
+	return true;
+}
+
+template <typename K, typename V, typename Compare>
+bool LFSkipList<K, V, Compare>::erase(K const& key)
+{
+	Node *preds[MAX_LEVEL];
+	Node *succs[MAX_LEVEL];
+	bool collect = false;
+	{
+		EpochGuard guard;
+		if(!Find(key, preds, succs))
+			return false;
+
+		Node *const victim = succs[0];
+		if(!Remove(victim))
+			return false;
+
+		count.fetch_sub(1, std::memory_order_relaxed);
+		Purge(key);
+		collect = Release(victim);
+	}
+	if(collect)
+		Collect();
+	return true;
+}
+
+// Removes the smallest entry. Threads that lose the race for the first node
+// move on to the next one instead of retrying from the head.
+template <typename K, typename V, typename Compare>
+bool LFSkipList<K, V, Compare>::pop_min(K& key, V& value)
+{
+	bool found = false;
+	bool collect = false;
+	{
+		EpochGuard guard;
+		for(Node *n = Unmarked(head->next[0].load()); n; n = Unmarked(n->next[0].load()))
+		{
+			if(IsMarked(n->next[0].load()) || !Remove(n))
+				continue;
+
+			count.fetch_sub(1, std::memory_order_relaxed);
+			key = n->key;
+			value = n->value;
+			Purge(key);
+			collect = Release(n);
+			found = true;
+			break;
+		}
+	}
+	if(collect)
+		Collect();
+	return found;
+}
+
+template <typename K, typename V, typename Compare>
+std::size_t LFSkipList<K, V, Compare>::size() const
+{
+	return count.load(std::memory_order_relaxed);
+}
+
+template <typename K, typename V, typename Compare>
+template <typename F>
+void LFSkipList<K, V, Compare>::for_each(K const& from, K const& to, F f)
+{
+	EpochGuard guard;
+	Node *pred = head;
+	for(int level = MAX_LEVEL - 1; level >= 0; level--)
+	{
+		Node *curr = Unmarked(pred->next[level].load(std::memory_order_acquire));
+		while(curr && less(curr->key, from))
+		{
+			pred = curr;
+			curr = Unmarked(curr->next[level].load(std::memory_order_acquire));
+		}
+	}
+
+	for(Node *n = Unmarked(pred->next[0].load(std::memory_order_acquire)); n; )
+	{
+		Node *const next = n->next[0].load(std::memory_order_acquire);
+		if(!less(n->key, to))
+			break;
+		if(!IsMarked(next) && !less(n->key, from))
+			f(n->key, n->value);
+		n = Unmarked(next);
+	}
+}
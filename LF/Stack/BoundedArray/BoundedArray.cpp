@@ -0,0 +1,214 @@
+#include "stdafx.h"
+#include <iostream>
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+#include <chrono>
+#include <cstdint>
+
+#include "../ReclamationPolicy/lf_stack.h"
+
+using namespace std;
+
+// Fixed capacity Treiber stack over one contiguous array of nodes. Links are
+// array indices, so the whole top (index + version tag) fits a single 64-bit
+// CAS and the tag takes care of ABA. Free nodes sit in a second stack on the
+// same array: nodes are never deleted, no reclamation scheme is needed and a
+// stale read of next is harmless because the CAS then fails on the tag.
+template <typename T>
+class LFStackArray
+{
+private:
+	static uint32_t const NIL = UINT32_MAX;
+
+	struct TaggedIndex
+	{
+		uint32_t index;
+		uint32_t tag;
+	};
+
+	struct Node
+	{
+		T data;
+		atomic<uint32_t> next;
+	};
+
+	unique_ptr<Node[]> nodes;
+	uint32_t const capacity;
+	atomic<TaggedIndex> head;
+	atomic<TaggedIndex> freeList;
+
+	uint32_t Pop(atomic<TaggedIndex>& top);
+	void Push(atomic<TaggedIndex>& top, uint32_t index);
+public:
+	explicit LFStackArray(uint32_t capacity_);
+	LFStackArray(LFStackArray const&) = delete;
+	LFStackArray& operator=(LFStackArray const&) = delete;
+
+	bool push(T const& data);
+	bool pop(T& data);
+	uint32_t Capacity() const;
+	void show();
+};
+
+template <typename T>
+LFStackArray<T>::LFStackArray(uint32_t capacity_)
+: nodes(new Node[capacity_]), capacity(capacity_)
+{
+	for(uint32_t i = 0; i < capacity; i++)
+		nodes[i].next.store(i + 1 < capacity ? i + 1 : NIL, memory_order::memory_order_relaxed);
+
+	head.store(TaggedIndex{NIL, 0});
+	freeList.store(TaggedIndex{capacity ? 0 : NIL, 0});
+}
+
+template <typename T>
+uint32_t LFStackArray<T>::Pop(atomic<TaggedIndex>& top)
+{
+	TaggedIndex oldTop = top.load(memory_order::memory_order_acquire);
+	TaggedIndex newTop;
+	do
+	{
+		if(oldTop.index == NIL)
+			return NIL;
+		newTop.index = nodes[oldTop.index].next.load(memory_order::memory_order_relaxed);
+		newTop.tag = oldTop.tag + 1;
+	}
+	while(!top.compare_exchange_weak(oldTop, newTop,
+									 memory_order::memory_order_acquire, memory_order::memory_order_acquire))
+		;
+	return oldTop.index;
+}
+
+template <typename T>
+void LFStackArray<T>::Push(atomic<TaggedIndex>& top, uint32_t index)
+{
+	TaggedIndex oldTop = top.load(memory_order::memory_order_relaxed);
+	TaggedIndex newTop;
+	do
+	{
+		nodes[index].next.store(oldTop.index, memory_order::memory_order_relaxed);
+		newTop.index = index;
+		newTop.tag = oldTop.tag + 1;
+	}
+	while(!top.compare_exchange_weak(oldTop, newTop,
+									 memory_order::memory_order_release, memory_order::memory_order_relaxed))
+		;
+}
+
+// false when all slots are taken
+template <typename T>
+bool LFStackArray<T>::push(T const& data)
+{
+	uint32_t const index = Pop(freeList);
+	if(index == NIL)
+		return false;
+
+	nodes[index].data = data;
+	Push(head, index);
+	return true;
+}
+
+// false when the stack is empty
+template <typename T>
+bool LFStackArray<T>::pop(T& data)
+{
+	uint32_t const index = Pop(head);
+	if(index == NIL)
+		return false;
+
+	data = move(nodes[index].data);
+	Push(freeList, index);
+	return true;
+}
+
+template <typename T>
+uint32_t LFStackArray<T>::Capacity() const
+{
+	return capacity;
+}
+
+template <typename T>
+void LFStackArray<T>::show()
+{
+	for(uint32_t i = head.load().index; i != NIL; i = nodes[i].next.load())
+		printf("%d \n", nodes[i].data);
+}
+
+// Every thread keeps depth elements on the stack and cycles through them, so
+// pops walk a deep stack rather than bouncing a single node
+template <typename Stack, typename Push, typename Pop>
+double Benchmark(Stack& stack, Push push, Pop pop, unsigned threadsCount, int depth, int rounds)
+{
+	vector<thread> threads;
+
+	auto const start = chrono::steady_clock::now();
+	for(unsigned t = 0; t < threadsCount; t++)
+	{
+		threads.emplace_back([&]
+		{
+			for(int r = 0; r < rounds; r++)
+			{
+				for(int i = 0; i < depth; i++)
+					push(stack, i);
+				for(int i = 0; i < depth; i++)
+					pop(stack);
+			}
+		});
+	}
+	for(thread& t : threads)
+		t.join();
+	chrono::duration<double> const elapsed = chrono::steady_clock::now() - start;
+
+	return double(threadsCount) * depth * rounds / elapsed.count();
+}
+
+int main()
+{
+	LFStackArray<int> lfstak(4);
+
+	lfstak.push(5);
+	lfstak.push(8);
+	lfstak.push(10);
+	lfstak.push(12);
+	cout << "push into full stack: " << (lfstak.push(13) ? "ok" : "full") << endl;
+
+	cout << "show\n";
+	lfstak.show();
+	cout << endl;
+
+	int v;
+	lfstak.pop(v);
+	cout << "pop: " << v << endl;
+	lfstak.pop(v);
+	cout << "pop: " << v << endl;
+	cout << endl;
+
+	lfstak.push(1);
+
+	cout << "show\n";
+	lfstak.show();
+	cout << endl;
+
+	unsigned const threadsCount = 4;
+	int const depth = 4096;
+	int const rounds = 50;
+
+	LFStackArray<int> arrayStack(threadsCount * depth);
+	double const array = Benchmark(arrayStack,
+		[](LFStackArray<int>& s, int i) { s.push(i); },
+		[](LFStackArray<int>& s) { int value; s.pop(value); },
+		threadsCount, depth, rounds);
+
+	LFStack<int, HazardPointerReclaimer> linkedStack;
+	double const linked = Benchmark(linkedStack,
+		[](LFStack<int, HazardPointerReclaimer>& s, int i) { s.push(i); },
+		[](LFStack<int, HazardPointerReclaimer>& s) { s.pop(); },
+		threadsCount, depth, rounds);
+
+	cout << "array stack:          " << array << " push+pop/s" << endl;
+	cout << "linked stack (HP):    " << linked << " push+pop/s" << endl;
+
+	return 0;
+}
@@ -2,6 +2,7 @@
 #include <iostream>
 #include <atomic>
 #include <memory>
+#include <vector>
 
 using namespace std;
 
@@ -24,6 +25,7 @@ private:
 
 	void DeleteNodes(Node *nodes);
 	void TryReclaim(Node *oldHead);
+	void TryReclaimChain(Node *nodes);
 	void ChainPendingNodes(Node* nodes);
 	void ChainPendingNodes(Node* first, Node* last);
 	void ChainPendingNode(Node* n);
@@ -32,7 +34,10 @@ public:
 	~LFStackGB();
 
 	void push(T const& data);
+	template <typename Iterator>
+	void push_range(Iterator first, Iterator last);
 	shared_ptr<T> pop();
+	vector<shared_ptr<T>> pop_all();
 	void show();
 };
 
@@ -57,6 +62,29 @@ void LFStackGB<T>::push(T const& data)
 		;
 }
 
+// Links the values into a local chain and publishes it with a single CAS,
+// the last value of the range ends up on top as with repeated push()
+template <typename T>
+template <typename Iterator>
+void LFStackGB<T>::push_range(Iterator first, Iterator last)
+{
+	if(first == last)
+		return;
+
+	Node *const bottom = new Node(*first);
+	Node *top = bottom;
+	for(++first; first != last; ++first)
+	{
+		Node *const newNode = new Node(*first);
+		newNode->next = top;
+		top = newNode;
+	}
+
+	bottom->next = head.load();
+	while(!head.compare_exchange_weak(bottom->next, top))
+		;
+}
+
 template <typename T>
 shared_ptr<T> LFStackGB<T>::pop()
 {
@@ -74,6 +102,23 @@ shared_ptr<T> LFStackGB<T>::pop()
 	return res;
 }
 
+// Detaches the whole stack with one exchange, values come back top first
+template <typename T>
+vector<shared_ptr<T>> LFStackGB<T>::pop_all()
+{
+	++threadsInPop;
+	Node *const nodes = head.exchange(nullptr);
+
+	vector<shared_ptr<T>> res;
+	for(Node *n = nodes; n; n = n->next)
+	{
+		res.emplace_back();
+		res.back().swap(n->data);
+	}
+	TryReclaimChain(nodes);
+	return res;
+}
+
 template <typename T>
 void LFStackGB<T>::TryReclaim(Node *oldHead)
 {
@@ -93,6 +138,26 @@ void LFStackGB<T>::TryReclaim(Node *oldHead)
 	}
 }
 
+template <typename T>
+void LFStackGB<T>::TryReclaimChain(Node *nodes)
+{
+	if(threadsInPop == 1)
+	{
+		Node *nodesToDelete = toBeDeleted.exchange(nullptr);
+		if(!--threadsInPop)
+			DeleteNodes(nodesToDelete);
+		else if(nodesToDelete)
+			ChainPendingNodes(nodesToDelete);
+		DeleteNodes(nodes);
+	}
+	else
+	{
+		if(nodes)
+			ChainPendingNodes(nodes);
+		--threadsInPop;
+	}
+}
+
 template <typename T>
 void LFStackGB<T>::DeleteNodes(Node *nodes)
 {
@@ -168,5 +233,13 @@ int main()
 	lfstak.show();
 	cout << endl;
 
+	int const batch[] = {20, 21, 22};
+	lfstak.push_range(begin(batch), end(batch));
+
+	cout << "pop_all:";
+	for(shared_ptr<int> const& v : lfstak.pop_all())
+		cout << " " << *v;
+	cout << endl;
+
 	return 0;
 }
\ No newline at end of file
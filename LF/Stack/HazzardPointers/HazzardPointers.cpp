@@ -4,132 +4,14 @@
 #include <memory>
 #include <atomic>
 #include <thread>
+#include <vector>
+#include <chrono>
 
-using namespace std;
-
-struct HazardPointer
-{
-	atomic<thread::id> id;
-	atomic<void*> pointer;
-};
-
-unsigned const MAX_HAZARD_POINTERS = 100;
-HazardPointer hazard_pointers[MAX_HAZARD_POINTERS];
-
-class HPOwner
-{
-	HazardPointer *hp;
-public:
-	HPOwner();
-
-	HPOwner(HPOwner const&) = delete;
-	HPOwner operator=(HPOwner const&) = delete;
+#include "hazard_pointers.h"
 
-	~HPOwner();
-
-	atomic<void *>& GetPointer();
-};
-
-HPOwner::HPOwner()
-: hp(nullptr)
-{
-	for(unsigned i = 0; i < MAX_HAZARD_POINTERS; i++)
-	{
-		thread::id old_id;
-		if(hazard_pointers[i].id.compare_exchange_weak(
-			old_id, this_thread::get_id()))
-		{
-			hp = &hazard_pointers[i];
-			break;
-		}
-
-		if(!hp)
-			throw runtime_error("No hazard pointers available");
-	}
-}
-
-HPOwner::~HPOwner()
-{
-	hp->pointer.store(nullptr);
-	hp->id.store(thread::id());
-}
-
-atomic<void *>& HPOwner::GetPointer()
-{
-	return hp->pointer;
-}
-
-atomic<void*> & GetHazardPointerForCurrentThread()
-{
-	thread_local static HPOwner hazard;
-	return hazard.GetPointer();
-}
-
-bool HasHazardPointerFor(void *p)
-{
-	for(unsigned i = 0; i < MAX_HAZARD_POINTERS; i++)
-		if(hazard_pointers[i].pointer.load() == p)
-			return true;
-	return false;
-}
-
-template <typename T>
-void DoDelete(void *p)
-{
-	delete static_cast<T*>(p);
-}
-
-struct DataToReclaim {
-	void *data;
-	function<void(void*)> deleter;
-	DataToReclaim *next;
-
-	template <typename T>
-	DataToReclaim(T* p);
-	~DataToReclaim();
-};
-
-atomic<DataToReclaim*> nodes_to_reclaim;
-
-template <typename T>
-DataToReclaim::DataToReclaim(T* p)
-: data(p)
-, deleter(&DoDelete<T>)
-, next(0)
-{}
-
-DataToReclaim::~DataToReclaim() {
-	deleter(data);
-}
-
-void AddToReclaimList(DataToReclaim* Node)
-{
-	Node->next = nodes_to_reclaim.load();
-	while(nodes_to_reclaim.compare_exchange_weak(Node->next, Node))
-		;
-}
-
-template <typename T>
-void ReclaimLater(T* data)
-{
-	AddToReclaimList(new DataToReclaim(data));
-}
-
-void DeleteNodesWithNoHazards()
-{
-	DataToReclaim* current = nodes_to_reclaim.exchange(nullptr);
-	while(current)
-	{
-		DataToReclaim* const next = current->next;
-		if(!HasHazardPointerFor(current->data))
-			delete current;
-		else
-			AddToReclaimList(current);
-		current = next;
-	}
-}
+using namespace std;
 
-template <typename T>
+template <typename T, typename Fence = SymmetricFence>
 class LFstackHP
 {
 private:
@@ -143,14 +25,19 @@ private:
 	};
 
 	atomic<Node*> head = {nullptr};
+
+	void Retire(Node *first, Node *last);
 public:
 	void push(T const& data);
+	template <typename Iterator>
+	void push_range(Iterator first, Iterator last);
 	shared_ptr<T> pop();
+	vector<shared_ptr<T>> pop_all();
 	void show();
 };
 
-template <typename T>
-void LFstackHP<T>::push(T const& data)
+template <typename T, typename Fence>
+void LFstackHP<T, Fence>::push(T const& data)
 {
 	Node *const new_node = new Node(data);
 	new_node->next = head.load();
@@ -158,8 +45,68 @@ void LFstackHP<T>::push(T const& data)
 		;
 }
 
-template <typename T>
-shared_ptr<T> LFstackHP<T>::pop()
+// Links the values into a local chain and publishes it with a single CAS,
+// the last value of the range ends up on top as with repeated push()
+template <typename T, typename Fence>
+template <typename Iterator>
+void LFstackHP<T, Fence>::push_range(Iterator first, Iterator last)
+{
+	if(first == last)
+		return;
+
+	Node *const bottom = new Node(*first);
+	Node *top = bottom;
+	for(++first; first != last; ++first)
+	{
+		Node *const new_node = new Node(*first);
+		new_node->next = top;
+		top = new_node;
+	}
+
+	bottom->next = head.load();
+	while(!head.compare_exchange_weak(bottom->next, top))
+		;
+}
+
+// Retires the unlinked nodes first..last, following next
+template <typename T, typename Fence>
+void LFstackHP<T, Fence>::Retire(Node *first, Node *last)
+{
+	if(Fence::BATCHED)
+	{
+		RetiredList &retired = GetRetiredListForCurrentThread();
+		for(Node *n = first; ; n = n->next)
+		{
+			retired.Retire(n);
+			if(n == last)
+				break;
+		}
+		if(retired.Full())
+		{
+			Fence::BeforeScan();
+			retired.DeleteNodesWithNoHazards();
+		}
+	}
+	else
+	{
+		Fence::BeforeScan();
+		for(Node *n = first, *next; ; n = next)
+		{
+			bool const isLast = n == last;
+			next = n->next;
+			if(HasHazardPointerFor(n))
+				ReclaimLater(n);
+			else
+				delete n;
+			if(isLast)
+				break;
+		}
+		DeleteNodesWithNoHazards();
+	}
+}
+
+template <typename T, typename Fence>
+shared_ptr<T> LFstackHP<T, Fence>::pop()
 {
 	atomic<void*> &hp = GetHazardPointerForCurrentThread();
 	Node *old_head = head.load();
@@ -167,7 +114,7 @@ shared_ptr<T> LFstackHP<T>::pop()
 		Node *temp;
 		do {
 			temp = old_head;
-			hp.store(old_head);
+			Fence::Publish(hp, old_head);
 			old_head = head.load();
 		}
 		while(old_head != temp)
@@ -175,23 +122,39 @@ shared_ptr<T> LFstackHP<T>::pop()
 	}
 	while(old_head && !head.compare_exchange_strong(old_head, old_head->next))
 		;
-	hp.store(nullptr);
+	hp.store(nullptr, memory_order::memory_order_release);
 
 	shared_ptr<T> res;
 	if(old_head)
 	{
 		res.swap(old_head->data);
-		if(HasHazardPointerFor(old_head))
-			ReclaimLater(old_head);
-		else
-			delete old_head;
-		DeleteNodesWithNoHazards();
+		Retire(old_head, old_head);
+	}
+	return res;
+}
+
+// Detaches the whole stack with one exchange, values come back top first
+template <typename T, typename Fence>
+vector<shared_ptr<T>> LFstackHP<T, Fence>::pop_all()
+{
+	Node *const nodes = head.exchange(nullptr);
+	if(!nodes)
+		return vector<shared_ptr<T>>();
+
+	vector<shared_ptr<T>> res;
+	Node *last = nodes;
+	for(Node *n = nodes; n; n = n->next)
+	{
+		res.emplace_back();
+		res.back().swap(n->data);
+		last = n;
 	}
+	Retire(nodes, last);
 	return res;
 }
 
-template <typename T>
-void LFstackHP<T>::show()
+template <typename T, typename Fence>
+void LFstackHP<T, Fence>::show()
 {
 	Node* n = head.load();
 	while(n)
@@ -201,6 +164,58 @@ void LFstackHP<T>::show()
 	}
 }
 
+template <typename Fence>
+double Benchmark(unsigned threadsCount, int operations)
+{
+	LFstackHP<int, Fence> stack;
+	vector<thread> threads;
+
+	auto const start = chrono::steady_clock::now();
+	for(unsigned t = 0; t < threadsCount; t++)
+	{
+		threads.emplace_back([&]
+		{
+			for(int i = 0; i < operations; i++)
+			{
+				stack.push(i);
+				stack.pop();
+			}
+		});
+	}
+	for(thread& t : threads)
+		t.join();
+	chrono::duration<double> const elapsed = chrono::steady_clock::now() - start;
+
+	return threadsCount * operations / elapsed.count();
+}
+
+// Same amount of work as Benchmark, in batches of batchSize elements
+template <typename Fence>
+double BatchBenchmark(unsigned threadsCount, int operations, int batchSize)
+{
+	LFstackHP<int, Fence> stack;
+	vector<thread> threads;
+
+	auto const start = chrono::steady_clock::now();
+	for(unsigned t = 0; t < threadsCount; t++)
+	{
+		threads.emplace_back([&]
+		{
+			vector<int> batch(batchSize);
+			for(int i = 0; i < operations; i += batchSize)
+			{
+				stack.push_range(batch.begin(), batch.end());
+				stack.pop_all();
+			}
+		});
+	}
+	for(thread& t : threads)
+		t.join();
+	chrono::duration<double> const elapsed = chrono::steady_clock::now() - start;
+
+	return threadsCount * operations / elapsed.count();
+}
+
 int main()
 {
 	LFstackHP<int> lfstak;
@@ -228,5 +243,20 @@ int main()
 	lfstak.show();
 	cout << endl;
 
+	int const batch[] = {20, 21, 22};
+	lfstak.push_range(begin(batch), end(batch));
+
+	cout << "pop_all:";
+	for(shared_ptr<int> const& v : lfstak.pop_all())
+		cout << " " << *v;
+	cout << endl;
+
+	unsigned const threadsCount = 4;
+	int const operations = 200000;
+	cout << "membarrier: " << (AsymmetricFenceAvailable() ? "yes" : "no") << endl;
+	cout << "symmetric:  " << Benchmark<SymmetricFence>(threadsCount, operations) << " push+pop/s" << endl;
+	cout << "asymmetric: " << Benchmark<AsymmetricFence>(threadsCount, operations) << " push+pop/s" << endl;
+	cout << "asymmetric, batch 16: " << BatchBenchmark<AsymmetricFence>(threadsCount, operations, 16) << " push+pop/s" << endl;
+
 	return 0;
 }
\ No newline at end of file
@@ -0,0 +1,468 @@
+#pragma once
+
+#include <atomic>
+#include <functional>
+#include <vector>
+#include <algorithm>
+#include <stdexcept>
+#include <cstdint>
+
+#if defined(__AVX2__) || defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <immintrin.h>
+#endif
+
+#if defined(_WIN32)
+#include <windows.h>
+#elif defined(__linux__)
+#include <linux/membarrier.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include "../../bits.h"
+
+/*
+ * Hazard pointer slots are kept as a structure of arrays: every block holds
+ * a contiguous, cache aligned column of pointers that the reclaimer scans
+ * with SIMD, and a separate bitmap of free slots for the owners.
+ * Blocks are only ever added, so scanners never see freed memory.
+ */
+
+unsigned const HAZARD_SLOTS_PER_BLOCK = 64;
+
+struct alignas(64) HazardBlock
+{
+	std::atomic<void*> pointers[HAZARD_SLOTS_PER_BLOCK];
+	alignas(64) std::atomic<std::uint64_t> freeMask;
+	HazardBlock *next;
+
+	HazardBlock() : freeMask(~std::uint64_t(0)), next(nullptr)
+	{
+		for(unsigned i = 0; i < HAZARD_SLOTS_PER_BLOCK; i++)
+			pointers[i].store(nullptr, std::memory_order_relaxed);
+	}
+};
+
+static_assert(sizeof(std::atomic<void*>) == sizeof(void*),
+			  "hazard pointer column is scanned as plain pointers");
+
+#if UINTPTR_MAX == UINT64_MAX
+#define HAZARD_SET1_256(p) _mm256_set1_epi64x(static_cast<long long>(p))
+#define HAZARD_CMPEQ_256(a, b) _mm256_cmpeq_epi64(a, b)
+#define HAZARD_SET1_128(p) _mm_set1_epi64x(static_cast<long long>(p))
+#else
+#define HAZARD_SET1_256(p) _mm256_set1_epi32(static_cast<int>(p))
+#define HAZARD_CMPEQ_256(a, b) _mm256_cmpeq_epi32(a, b)
+#define HAZARD_SET1_128(p) _mm_set1_epi32(static_cast<int>(p))
+#endif
+
+inline bool BlockContains(HazardBlock const& block, void *p)
+{
+#if defined(__AVX2__)
+	__m256i const* column = reinterpret_cast<__m256i const*>(block.pointers);
+	__m256i const key = HAZARD_SET1_256(reinterpret_cast<std::uintptr_t>(p));
+	for(unsigned i = 0; i < HAZARD_SLOTS_PER_BLOCK * sizeof(void*) / sizeof(__m256i); i++)
+		if(_mm256_movemask_epi8(HAZARD_CMPEQ_256(_mm256_loadu_si256(column + i), key)))
+			return true;
+	return false;
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+	__m128i const* column = reinterpret_cast<__m128i const*>(block.pointers);
+	__m128i const key = HAZARD_SET1_128(reinterpret_cast<std::uintptr_t>(p));
+	for(unsigned i = 0; i < HAZARD_SLOTS_PER_BLOCK * sizeof(void*) / sizeof(__m128i); i++)
+	{
+		__m128i equal = _mm_cmpeq_epi32(_mm_loadu_si128(column + i), key);
+#if UINTPTR_MAX == UINT64_MAX
+		equal = _mm_and_si128(equal, _mm_shuffle_epi32(equal, _MM_SHUFFLE(2, 3, 0, 1)));
+#endif
+		if(_mm_movemask_epi8(equal))
+			return true;
+	}
+	return false;
+#else
+	for(unsigned i = 0; i < HAZARD_SLOTS_PER_BLOCK; i++)
+		if(block.pointers[i].load(std::memory_order_relaxed) == p)
+			return true;
+	return false;
+#endif
+}
+
+class HazardSlotTable
+{
+	HazardBlock first;
+	std::atomic<HazardBlock*> head;
+	std::atomic<unsigned> capacity;
+public:
+	HazardSlotTable() : head(&first), capacity(HAZARD_SLOTS_PER_BLOCK)
+	{}
+
+	HazardSlotTable(HazardSlotTable const&) = delete;
+	HazardSlotTable& operator=(HazardSlotTable const&) = delete;
+
+	~HazardSlotTable()
+	{
+		HazardBlock *b = head.load();
+		while(b != &first)
+		{
+			HazardBlock *next = b->next;
+			delete b;
+			b = next;
+		}
+	}
+
+	std::atomic<void*>& Acquire(HazardBlock*& owner)
+	{
+		for(HazardBlock *b = head.load(std::memory_order_acquire); b; b = b->next)
+		{
+			std::uint64_t mask = b->freeMask.load(std::memory_order_relaxed);
+			while(mask)
+			{
+				std::uint64_t const bit = std::uint64_t(1) << LowestSetBit(mask);
+				if(b->freeMask.compare_exchange_weak(mask, mask & ~bit,
+													 std::memory_order_acquire,
+													 std::memory_order_relaxed))
+				{
+					owner = b;
+					return b->pointers[LowestSetBit(bit)];
+				}
+			}
+		}
+
+		HazardBlock *const b = new HazardBlock;
+		b->freeMask.store(~std::uint64_t(1), std::memory_order_relaxed);
+		b->next = head.load(std::memory_order_relaxed);
+		while(!head.compare_exchange_weak(b->next, b,
+										  std::memory_order_release,
+										  std::memory_order_relaxed))
+			;
+		capacity.fetch_add(HAZARD_SLOTS_PER_BLOCK, std::memory_order_relaxed);
+		owner = b;
+		return b->pointers[0];
+	}
+
+	void Release(HazardBlock *owner, std::atomic<void*>& slot)
+	{
+		slot.store(nullptr, std::memory_order_release);
+		std::uint64_t const bit = std::uint64_t(1) << (&slot - owner->pointers);
+		owner->freeMask.fetch_or(bit, std::memory_order_release);
+	}
+
+	unsigned Capacity() const
+	{
+		return capacity.load(std::memory_order_relaxed);
+	}
+
+	bool Contains(void *p) const
+	{
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		for(HazardBlock const *b = head.load(std::memory_order_acquire); b; b = b->next)
+			if(BlockContains(*b, p))
+				return true;
+		return false;
+	}
+
+	void Snapshot(std::vector<void*>& hazards) const
+	{
+		for(HazardBlock const *b = head.load(std::memory_order_acquire); b; b = b->next)
+			for(unsigned i = 0; i < HAZARD_SLOTS_PER_BLOCK; i++)
+				if(void *p = b->pointers[i].load(std::memory_order_relaxed))
+					hazards.push_back(p);
+	}
+};
+
+inline HazardSlotTable& GetHazardSlotTable()
+{
+	static HazardSlotTable table;
+	return table;
+}
+
+class HPOwner
+{
+	HazardBlock *block;
+	std::atomic<void*> *hp;
+public:
+	HPOwner();
+
+	HPOwner(HPOwner const&) = delete;
+	HPOwner operator=(HPOwner const&) = delete;
+
+	~HPOwner();
+
+	std::atomic<void *>& GetPointer();
+};
+
+inline HPOwner::HPOwner()
+: block(nullptr), hp(&GetHazardSlotTable().Acquire(block))
+{}
+
+inline HPOwner::~HPOwner()
+{
+	GetHazardSlotTable().Release(block, *hp);
+}
+
+inline std::atomic<void *>& HPOwner::GetPointer()
+{
+	return *hp;
+}
+
+inline std::atomic<void*> & GetHazardPointerForCurrentThread()
+{
+	thread_local static HPOwner hazard;
+	return hazard.GetPointer();
+}
+
+// N hazard pointers of the current thread, for structures that keep more than
+// one node protected at a time while walking a list
+template <unsigned N>
+class HPOwners
+{
+	HPOwner owners[N];
+public:
+	std::atomic<void *>& GetPointer(unsigned i)
+	{
+		return owners[i].GetPointer();
+	}
+};
+
+template <unsigned N>
+std::atomic<void *>& GetHazardPointerForCurrentThread(unsigned i)
+{
+	thread_local static HPOwners<N> hazards;
+	return hazards.GetPointer(i);
+}
+
+inline bool HasHazardPointerFor(void *p)
+{
+	return GetHazardSlotTable().Contains(p);
+}
+
+template <typename T>
+void DoDelete(void *p)
+{
+	delete static_cast<T*>(p);
+}
+
+struct DataToReclaim {
+	void *data;
+	std::function<void(void*)> deleter;
+	DataToReclaim *next;
+
+	template <typename T>
+	DataToReclaim(T* p);
+	DataToReclaim(void *p, std::function<void(void*)> deleter_);
+	~DataToReclaim();
+};
+
+inline std::atomic<DataToReclaim*>& GetNodesToReclaim()
+{
+	static std::atomic<DataToReclaim*> nodes_to_reclaim{nullptr};
+	return nodes_to_reclaim;
+}
+
+template <typename T>
+DataToReclaim::DataToReclaim(T* p)
+: data(p)
+, deleter(&DoDelete<T>)
+, next(0)
+{}
+
+inline DataToReclaim::DataToReclaim(void *p, std::function<void(void*)> deleter_)
+: data(p)
+, deleter(std::move(deleter_))
+, next(0)
+{}
+
+inline DataToReclaim::~DataToReclaim() {
+	deleter(data);
+}
+
+inline void AddToReclaimList(DataToReclaim* Node)
+{
+	std::atomic<DataToReclaim*>& nodes_to_reclaim = GetNodesToReclaim();
+	Node->next = nodes_to_reclaim.load();
+	while(!nodes_to_reclaim.compare_exchange_weak(Node->next, Node))
+		;
+}
+
+template <typename T>
+void ReclaimLater(T* data)
+{
+	AddToReclaimList(new DataToReclaim(data));
+}
+
+inline void DeleteNodesWithNoHazards()
+{
+	DataToReclaim* current = GetNodesToReclaim().exchange(nullptr);
+	while(current)
+	{
+		DataToReclaim* const next = current->next;
+		if(!HasHazardPointerFor(current->data))
+			delete current;
+		else
+			AddToReclaimList(current);
+		current = next;
+	}
+}
+
+inline bool RegisterAsymmetricFence()
+{
+#if defined(_WIN32)
+	return true;
+#elif defined(__linux__)
+	return syscall(SYS_membarrier, MEMBARRIER_CMD_REGISTER_PRIVATE_EXPEDITED, 0) == 0;
+#else
+	return false;
+#endif
+}
+
+inline bool AsymmetricFenceAvailable()
+{
+	static bool const available = RegisterAsymmetricFence();
+	return available;
+}
+
+// Cheap side of the asymmetric fence, only stops compiler reordering while
+// the heavy side is available
+inline void LightFence()
+{
+	if(AsymmetricFenceAvailable())
+		std::atomic_signal_fence(std::memory_order_seq_cst);
+	else
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+}
+
+// Forces a full fence on every running thread of the process
+inline void HeavyFence()
+{
+#if defined(_WIN32)
+	FlushProcessWriteBuffers();
+#elif defined(__linux__)
+	if(AsymmetricFenceAvailable())
+	{
+		syscall(SYS_membarrier, MEMBARRIER_CMD_PRIVATE_EXPEDITED, 0);
+		return;
+	}
+#endif
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+}
+
+// Readers publish with seq_cst and every pop scans the hazard pointers
+struct SymmetricFence
+{
+	static bool const BATCHED = false;
+
+	static void Publish(std::atomic<void*>& hp, void *p)
+	{
+		hp.store(p);
+	}
+
+	static void BeforeScan()
+	{}
+};
+
+// Readers publish with a release store and a compiler barrier, the
+// reclaimer pays for a process wide fence but scans only once per batch
+struct AsymmetricFence
+{
+	static bool const BATCHED = true;
+
+	static void Publish(std::atomic<void*>& hp, void *p)
+	{
+		hp.store(p, std::memory_order_release);
+		LightFence();
+	}
+
+	static void BeforeScan()
+	{
+		HeavyFence();
+	}
+};
+
+struct RetiredPointer
+{
+	void *data;
+	void (*deleter)(void*);
+};
+
+// Per thread batch of retired pointers, checked against one snapshot of
+// the hazard pointers once the batch is full. When the thread exits the
+// pointers still hazardous go to the global reclaim list, which every later
+// batch scan drains as well.
+class RetiredList
+{
+	std::vector<RetiredPointer> pointers;
+public:
+	RetiredList() = default;
+	RetiredList(RetiredList const&) = delete;
+	RetiredList operator=(RetiredList const&) = delete;
+
+	~RetiredList();
+
+	template <typename T>
+	void Retire(T *p);
+	bool Full() const;
+	void DeleteNodesWithNoHazards();
+};
+
+inline RetiredList::~RetiredList()
+{
+	HeavyFence();
+	DeleteNodesWithNoHazards();
+	for(RetiredPointer const& p : pointers)
+		AddToReclaimList(new DataToReclaim(p.data, p.deleter));
+}
+
+template <typename T>
+void RetiredList::Retire(T *p)
+{
+	pointers.push_back({p, &DoDelete<T>});
+}
+
+inline bool RetiredList::Full() const
+{
+	return pointers.size() >= 2 * GetHazardSlotTable().Capacity();
+}
+
+inline void RetiredList::DeleteNodesWithNoHazards()
+{
+	// Exited threads leave what was still hazardous in the global list. The
+	// caller fenced before those could be taken, so take them first and
+	// fence again: a hazard published before one of them was handed over
+	// is then in the snapshot below.
+	DataToReclaim* orphans = nullptr;
+	if(GetNodesToReclaim().load(std::memory_order_relaxed))
+	{
+		orphans = GetNodesToReclaim().exchange(nullptr);
+		HeavyFence();
+	}
+
+	std::vector<void*> hazards;
+	hazards.reserve(GetHazardSlotTable().Capacity());
+	GetHazardSlotTable().Snapshot(hazards);
+	std::sort(hazards.begin(), hazards.end());
+
+	size_t kept = 0;
+	for(RetiredPointer const& p : pointers)
+	{
+		if(std::binary_search(hazards.begin(), hazards.end(), p.data))
+			pointers[kept++] = p;
+		else
+			p.deleter(p.data);
+	}
+	pointers.resize(kept);
+
+	while(orphans)
+	{
+		DataToReclaim* const next = orphans->next;
+		if(std::binary_search(hazards.begin(), hazards.end(), orphans->data))
+			AddToReclaimList(orphans);
+		else
+			delete orphans;
+		orphans = next;
+	}
+}
+
+inline RetiredList& GetRetiredListForCurrentThread()
+{
+	thread_local static RetiredList retired;
+	return retired;
+}
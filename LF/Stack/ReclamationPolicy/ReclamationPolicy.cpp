@@ -0,0 +1,79 @@
+#include "stdafx.h"
+#include <iostream>
+#include <memory>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <chrono>
+
+#include "lf_stack.h"
+
+using namespace std;
+
+template <typename Reclaimer>
+void Demo(char const *name)
+{
+	cout << "=== " << name << "\n";
+
+	LFStack<int, Reclaimer> lfstak;
+
+	lfstak.push(5);
+	lfstak.push(8);
+	lfstak.push(10);
+
+	cout << "show\n";
+	lfstak.show();
+	cout << endl;
+
+	cout << "pop: " << *lfstak.pop() << endl;
+	cout << "pop: " << *lfstak.pop() << endl;
+	cout << endl;
+
+	lfstak.push(1);
+	lfstak.push(2);
+
+	cout << "show\n";
+	lfstak.show();
+	cout << endl;
+
+	unsigned const threadsCount = 4;
+	int const perThread = 10000;
+	atomic<long long> popped{0};
+	vector<thread> threads;
+	for(unsigned t = 0; t < threadsCount; t++)
+	{
+		threads.emplace_back([&]
+		{
+			for(int i = 0; i < perThread; i++)
+			{
+				lfstak.push(i);
+				if(shared_ptr<int> v = lfstak.pop())
+					popped += 1;
+			}
+		});
+	}
+	for(thread& t : threads)
+		t.join();
+
+	cout << "concurrent pops: " << popped << " of " << threadsCount * perThread << endl;
+
+	while(lfstak.pop())
+		;
+	thread consumer([&] { cout << "wait_pop: " << *lfstak.wait_pop() << endl; });
+	this_thread::sleep_for(chrono::milliseconds(10));
+	lfstak.push(42);
+	consumer.join();
+	cout << "wait_pop_for: " << (lfstak.wait_pop_for(chrono::milliseconds(10)) ? "value" : "timeout") << endl;
+	cout << endl;
+}
+
+int main()
+{
+	Demo<RefCountReclaimer>("reference counting");
+	Demo<HazardPointerReclaimer>("hazard pointers");
+	Demo<ThreadsInPopReclaimer>("threads in pop");
+	Demo<EpochReclaimer>("epoch");
+	Demo<LeakReclaimer>("leak");
+
+	return 0;
+}
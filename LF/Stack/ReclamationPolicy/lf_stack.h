@@ -0,0 +1,690 @@
+#pragma once
+
+#include <cstdio>
+#include <memory>
+#include <atomic>
+#include <thread>
+#include <stdexcept>
+#include <chrono>
+
+#include "../HazzardPointers/hazard_pointers.h"
+#include "../../eventcount.h"
+#include "../../arena.h"
+
+// LFStack<T, Reclaimer> is the Treiber stack from the other LF/Stack projects
+// with the memory reclamation scheme pulled out into a policy. An optional
+// third parameter picks the node allocator from arena.h.
+//
+// A Reclaimer provides two member templates over the stack node type:
+//   Hook<Node>    base of every node: link to the next node plus whatever
+//                 bookkeeping the scheme needs (counters, epochs, ...)
+//   Domain<Node>  owns the head of the stack:
+//     void  Push(Node *n);
+//     Node* Load() const;            unprotected head, for show()
+//     static Node* Next(Node *n);
+//     class Guard                    one pop attempt
+//       explicit Guard(Domain&);
+//       Node* Protect();             head, safe to dereference while the guard lives
+//       bool  Unlink();              CAS head from the protected node to its next
+//       ~Guard();                    drops protection, retires the node if unlinked
+
+template <typename Node>
+struct LinkedHook
+{
+	Node *next = nullptr;
+	Node *retiredNext = nullptr;
+};
+
+template <typename Node>
+class AtomicHead
+{
+protected:
+	std::atomic<Node*> head{nullptr};
+
+	AtomicHead() = default;
+	AtomicHead(AtomicHead const&) = delete;
+	AtomicHead& operator=(AtomicHead const&) = delete;
+
+	bool CompareExchangeHead(Node *oldHead)
+	{
+		return head.compare_exchange_strong(oldHead, oldHead->next);
+	}
+
+	static void DeleteChain(Node *nodes)
+	{
+		while(nodes)
+		{
+			Node *next = nodes->retiredNext;
+			delete nodes;
+			nodes = next;
+		}
+	}
+
+	static void ChainNodes(std::atomic<Node*>& list, Node *first, Node *last)
+	{
+		last->retiredNext = list.load();
+		while(!list.compare_exchange_weak(last->retiredNext, first))
+			;
+	}
+
+public:
+	void Push(Node *n)
+	{
+		n->next = head.load();
+		while(!head.compare_exchange_weak(n->next, n))
+			;
+	}
+
+	Node* Load() const
+	{
+		return head.load();
+	}
+
+	static Node* Next(Node *n)
+	{
+		return n->next;
+	}
+};
+
+/*
+ * Split reference counting (LFStackRC / LFStackRCB)
+ */
+struct RefCountReclaimer
+{
+	template <typename Node>
+	struct CountedNodePtr
+	{
+		int externalCount = 0;
+		Node *ptr = nullptr;
+	};
+
+	template <typename Node>
+	struct Hook
+	{
+		std::atomic<int> internalCount{0};
+		CountedNodePtr<Node> next;
+	};
+
+	template <typename Node>
+	class Domain
+	{
+		std::atomic<CountedNodePtr<Node>> head{CountedNodePtr<Node>()};
+
+		void IncreaseHeadCount(CountedNodePtr<Node>& oldCounter)
+		{
+			CountedNodePtr<Node> newCounter;
+			do
+			{
+				newCounter = oldCounter;
+				++newCounter.externalCount;
+			}
+			while(!head.compare_exchange_strong(oldCounter, newCounter,
+												std::memory_order_acquire,
+												std::memory_order_relaxed))
+				;
+
+			oldCounter.externalCount = newCounter.externalCount;
+		}
+
+	public:
+		Domain() = default;
+		Domain(Domain const&) = delete;
+		Domain& operator=(Domain const&) = delete;
+
+		void Push(Node *n)
+		{
+			CountedNodePtr<Node> newNode;
+			newNode.ptr = n;
+			newNode.externalCount = 1;
+			n->next = head.load(std::memory_order_relaxed);
+			while(!head.compare_exchange_weak(n->next, newNode,
+											  std::memory_order_release,
+											  std::memory_order_relaxed))
+				;
+		}
+
+		Node* Load() const
+		{
+			return head.load().ptr;
+		}
+
+		static Node* Next(Node *n)
+		{
+			return n->next.ptr;
+		}
+
+		class Guard
+		{
+			Domain& domain;
+			CountedNodePtr<Node> oldHead;
+			Node *ptr = nullptr;
+			bool unlinked = false;
+		public:
+			explicit Guard(Domain& domain_)
+				: domain(domain_), oldHead(domain_.head.load(std::memory_order_relaxed))
+			{}
+
+			Guard(Guard const&) = delete;
+			Guard& operator=(Guard const&) = delete;
+
+			Node* Protect()
+			{
+				domain.IncreaseHeadCount(oldHead);
+				ptr = oldHead.ptr;
+				return ptr;
+			}
+
+			bool Unlink()
+			{
+				unlinked = domain.head.compare_exchange_strong(oldHead, ptr->next,
+															   std::memory_order_relaxed);
+				return unlinked;
+			}
+
+			~Guard()
+			{
+				if(!ptr)
+					return;
+
+				if(unlinked)
+				{
+					int const countIncrease = oldHead.externalCount - 2;
+					if(ptr->internalCount.fetch_add(countIncrease,
+													std::memory_order_release) == -countIncrease)
+						delete ptr;
+				}
+				else if(ptr->internalCount.fetch_add(-1, std::memory_order_relaxed) == 1)
+				{
+					ptr->internalCount.load(std::memory_order_acquire);
+					delete ptr;
+				}
+			}
+		};
+	};
+};
+
+/*
+ * Hazard pointers (LFstackHP)
+ */
+struct HazardPointerReclaimer
+{
+	template <typename Node>
+	using Hook = LinkedHook<Node>;
+
+	template <typename Node>
+	class Domain : public AtomicHead<Node>
+	{
+		std::atomic<Node*> nodesToReclaim{nullptr};
+
+		void ReclaimLater(Node *n)
+		{
+			this->ChainNodes(nodesToReclaim, n, n);
+		}
+
+		void DeleteNodesWithNoHazards()
+		{
+			Node *current = nodesToReclaim.exchange(nullptr);
+			while(current)
+			{
+				Node *const next = current->retiredNext;
+				if(!HasHazardPointerFor(current))
+					delete current;
+				else
+					ReclaimLater(current);
+				current = next;
+			}
+		}
+
+	public:
+		~Domain()
+		{
+			this->DeleteChain(nodesToReclaim.exchange(nullptr));
+		}
+
+		class Guard
+		{
+			Domain& domain;
+			std::atomic<void*>& hp;
+			Node *ptr = nullptr;
+			bool unlinked = false;
+		public:
+			explicit Guard(Domain& domain_)
+				: domain(domain_), hp(GetHazardPointerForCurrentThread())
+			{}
+
+			Guard(Guard const&) = delete;
+			Guard& operator=(Guard const&) = delete;
+
+			Node* Protect()
+			{
+				Node *temp;
+				ptr = domain.head.load();
+				do
+				{
+					temp = ptr;
+					hp.store(ptr);
+					ptr = domain.head.load();
+				}
+				while(ptr != temp)
+					;
+				return ptr;
+			}
+
+			bool Unlink()
+			{
+				unlinked = domain.CompareExchangeHead(ptr);
+				return unlinked;
+			}
+
+			~Guard()
+			{
+				hp.store(nullptr);
+				if(!unlinked)
+					return;
+
+				if(HasHazardPointerFor(ptr))
+					domain.ReclaimLater(ptr);
+				else
+					delete ptr;
+				domain.DeleteNodesWithNoHazards();
+			}
+		};
+	};
+};
+
+/*
+ * Count of threads in pop (LFStackGB)
+ */
+struct ThreadsInPopReclaimer
+{
+	template <typename Node>
+	using Hook = LinkedHook<Node>;
+
+	template <typename Node>
+	class Domain : public AtomicHead<Node>
+	{
+		std::atomic<Node*> toBeDeleted{nullptr};
+		std::atomic<unsigned> threadsInPop{0};
+
+		void ChainPendingNodes(Node *nodes)
+		{
+			Node *last = nodes;
+			while(Node *const next = last->retiredNext)
+				last = next;
+			this->ChainNodes(toBeDeleted, nodes, last);
+		}
+
+		void TryReclaim(Node *oldHead)
+		{
+			if(threadsInPop == 1)
+			{
+				Node *nodesToDelete = toBeDeleted.exchange(nullptr);
+				if(!--threadsInPop)
+					this->DeleteChain(nodesToDelete);
+				else if(nodesToDelete)
+					ChainPendingNodes(nodesToDelete);
+				delete oldHead;
+			}
+			else
+			{
+				this->ChainNodes(toBeDeleted, oldHead, oldHead);
+				--threadsInPop;
+			}
+		}
+
+	public:
+		~Domain()
+		{
+			this->DeleteChain(toBeDeleted.exchange(nullptr));
+		}
+
+		class Guard
+		{
+			Domain& domain;
+			Node *ptr = nullptr;
+			bool unlinked = false;
+		public:
+			explicit Guard(Domain& domain_)
+				: domain(domain_)
+			{
+				++domain.threadsInPop;
+			}
+
+			Guard(Guard const&) = delete;
+			Guard& operator=(Guard const&) = delete;
+
+			Node* Protect()
+			{
+				ptr = domain.head.load();
+				return ptr;
+			}
+
+			bool Unlink()
+			{
+				unlinked = domain.CompareExchangeHead(ptr);
+				return unlinked;
+			}
+
+			~Guard()
+			{
+				if(unlinked)
+					domain.TryReclaim(ptr);
+				else
+					--domain.threadsInPop;
+			}
+		};
+	};
+};
+
+/*
+ * Epoch based reclamation
+ */
+struct EpochRecord
+{
+	std::atomic<std::thread::id> id;
+	std::atomic<unsigned> epoch;
+	std::atomic<bool> active;
+};
+
+unsigned const MAX_EPOCH_RECORDS = 100;
+
+inline EpochRecord* GetEpochRecords()
+{
+	static EpochRecord epoch_records[MAX_EPOCH_RECORDS];
+	return epoch_records;
+}
+
+inline std::atomic<unsigned>& GetGlobalEpoch()
+{
+	static std::atomic<unsigned> global_epoch{0};
+	return global_epoch;
+}
+
+class EpochOwner
+{
+	EpochRecord *record;
+public:
+	EpochOwner();
+
+	EpochOwner(EpochOwner const&) = delete;
+	EpochOwner operator=(EpochOwner const&) = delete;
+
+	~EpochOwner();
+
+	EpochRecord& GetRecord();
+};
+
+inline EpochOwner::EpochOwner()
+: record(nullptr)
+{
+	EpochRecord *const records = GetEpochRecords();
+	for(unsigned i = 0; i < MAX_EPOCH_RECORDS; i++)
+	{
+		std::thread::id old_id;
+		if(records[i].id.compare_exchange_strong(
+			old_id, std::this_thread::get_id()))
+		{
+			record = &records[i];
+			break;
+		}
+	}
+
+	if(!record)
+		throw std::runtime_error("No epoch records available");
+}
+
+inline EpochOwner::~EpochOwner()
+{
+	record->active.store(false);
+	record->id.store(std::thread::id());
+}
+
+inline EpochRecord& EpochOwner::GetRecord()
+{
+	return *record;
+}
+
+inline EpochRecord& GetEpochRecordForCurrentThread()
+{
+	thread_local static EpochOwner owner;
+	return owner.GetRecord();
+}
+
+inline void TryAdvanceEpoch()
+{
+	EpochRecord *const records = GetEpochRecords();
+	unsigned current = GetGlobalEpoch().load();
+	for(unsigned i = 0; i < MAX_EPOCH_RECORDS; i++)
+		if(records[i].active.load() && records[i].epoch.load() != current)
+			return;
+	GetGlobalEpoch().compare_exchange_strong(current, current + 1);
+}
+
+struct EpochReclaimer
+{
+	template <typename Node>
+	struct Hook : LinkedHook<Node>
+	{
+		unsigned retiredEpoch = 0;
+	};
+
+	template <typename Node>
+	class Domain : public AtomicHead<Node>
+	{
+		std::atomic<Node*> retired{nullptr};
+
+		void DeleteExpiredNodes()
+		{
+			unsigned const current = GetGlobalEpoch().load();
+			Node *n = retired.exchange(nullptr);
+			while(n)
+			{
+				Node *const next = n->retiredNext;
+				// Signed: a node retired after current was read may carry
+				// current + 1, which must not wrap around into "old enough"
+				if(static_cast<int>(current - n->retiredEpoch) >= 2)
+					delete n;
+				else
+					this->ChainNodes(retired, n, n);
+				n = next;
+			}
+		}
+
+	public:
+		~Domain()
+		{
+			this->DeleteChain(retired.exchange(nullptr));
+		}
+
+		class Guard
+		{
+			Domain& domain;
+			EpochRecord& record;
+			Node *ptr = nullptr;
+			bool unlinked = false;
+		public:
+			explicit Guard(Domain& domain_)
+				: domain(domain_), record(GetEpochRecordForCurrentThread())
+			{
+				unsigned epoch;
+				record.active.store(true);
+				do
+				{
+					epoch = GetGlobalEpoch().load();
+					record.epoch.store(epoch);
+				}
+				while(epoch != GetGlobalEpoch().load())
+					;
+			}
+
+			Guard(Guard const&) = delete;
+			Guard& operator=(Guard const&) = delete;
+
+			Node* Protect()
+			{
+				ptr = domain.head.load();
+				return ptr;
+			}
+
+			bool Unlink()
+			{
+				unlinked = domain.CompareExchangeHead(ptr);
+				return unlinked;
+			}
+
+			~Guard()
+			{
+				if(unlinked)
+				{
+					ptr->retiredEpoch = GetGlobalEpoch().load();
+					domain.ChainNodes(domain.retired, ptr, ptr);
+				}
+				record.active.store(false);
+
+				if(unlinked)
+				{
+					TryAdvanceEpoch();
+					domain.DeleteExpiredNodes();
+				}
+			}
+		};
+	};
+};
+
+/*
+ * No reclamation while the stack is alive, popped nodes are kept in an
+ * arena list and freed together with the stack
+ */
+struct LeakReclaimer
+{
+	template <typename Node>
+	using Hook = LinkedHook<Node>;
+
+	template <typename Node>
+	class Domain : public AtomicHead<Node>
+	{
+		std::atomic<Node*> arena{nullptr};
+	public:
+		~Domain()
+		{
+			this->DeleteChain(arena.exchange(nullptr));
+		}
+
+		class Guard
+		{
+			Domain& domain;
+			Node *ptr = nullptr;
+			bool unlinked = false;
+		public:
+			explicit Guard(Domain& domain_)
+				: domain(domain_)
+			{}
+
+			Guard(Guard const&) = delete;
+			Guard& operator=(Guard const&) = delete;
+
+			Node* Protect()
+			{
+				ptr = domain.head.load();
+				return ptr;
+			}
+
+			bool Unlink()
+			{
+				unlinked = domain.CompareExchangeHead(ptr);
+				return unlinked;
+			}
+
+			~Guard()
+			{
+				if(unlinked)
+					domain.ChainNodes(domain.arena, ptr, ptr);
+			}
+		};
+	};
+};
+
+template <typename T, typename Reclaimer, typename Allocator = HeapAllocator>
+class LFStack
+{
+private:
+	struct Node : Reclaimer::template Hook<Node>, AllocatedBy<Allocator>
+	{
+		std::shared_ptr<T> data;
+		Node(T const& data_) : data(std::make_shared<T>(data_)) {}
+	};
+
+	typedef typename Reclaimer::template Domain<Node> Domain;
+
+	Domain domain;
+	EventCount nonEmpty;
+public:
+	LFStack() = default;
+	LFStack(LFStack const&) = delete;
+	LFStack& operator=(LFStack const&) = delete;
+	~LFStack();
+
+	void push(T const& data);
+	std::shared_ptr<T> pop();
+	std::shared_ptr<T> wait_pop();
+	template <typename Rep, typename Period>
+	std::shared_ptr<T> wait_pop_for(std::chrono::duration<Rep, Period> const& timeout);
+	void show();
+};
+
+template <typename T, typename Reclaimer, typename Allocator>
+LFStack<T, Reclaimer, Allocator>::~LFStack()
+{
+	while(pop())
+		;
+}
+
+template <typename T, typename Reclaimer, typename Allocator>
+void LFStack<T, Reclaimer, Allocator>::push(T const& data)
+{
+	domain.Push(new Node(data));
+	nonEmpty.notify_one();
+}
+
+template <typename T, typename Reclaimer, typename Allocator>
+std::shared_ptr<T> LFStack<T, Reclaimer, Allocator>::pop()
+{
+	for(;;)
+	{
+		typename Domain::Guard guard(domain);
+		Node *const node = guard.Protect();
+		if(!node)
+			return std::shared_ptr<T>();
+
+		if(guard.Unlink())
+		{
+			std::shared_ptr<T> res;
+			res.swap(node->data);
+			return res;
+		}
+	}
+}
+
+template <typename T, typename Reclaimer, typename Allocator>
+std::shared_ptr<T> LFStack<T, Reclaimer, Allocator>::wait_pop()
+{
+	return WaitPop(nonEmpty, [this] { return pop(); });
+}
+
+template <typename T, typename Reclaimer, typename Allocator>
+template <typename Rep, typename Period>
+std::shared_ptr<T> LFStack<T, Reclaimer, Allocator>::wait_pop_for(std::chrono::duration<Rep, Period> const& timeout)
+{
+	return WaitPopFor(nonEmpty, [this] { return pop(); }, timeout);
+}
+
+template <typename T, typename Reclaimer, typename Allocator>
+void LFStack<T, Reclaimer, Allocator>::show()
+{
+	Node* n = domain.Load();
+	while(n)
+	{
+		printf("%d \n", *n->data);
+		n = Domain::Next(n);
+	}
+}
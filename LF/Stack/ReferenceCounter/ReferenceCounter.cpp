@@ -4,10 +4,13 @@
 #include <memory>
 #include <atomic>
 #include <thread>
+#include <vector>
+
+#include "../../arena.h"
 
 using namespace std;
 
-template <typename T>
+template <typename T, typename Allocator = HeapAllocator>
 class LFStackRC
 {
 private:
@@ -18,7 +21,7 @@ private:
 		Node* ptr = nullptr;
 	};
 
-	struct Node {
+	struct Node : AllocatedBy<Allocator> {
 		shared_ptr<T> data;
 		atomic<int> internalCount;
 		CountedNodePtr next;
@@ -33,19 +36,22 @@ public:
 	~LFStackRC();
 
 	void push(T const& data);
+	template <typename Iterator>
+	void push_range(Iterator first, Iterator last);
 	shared_ptr<T> pop();
+	vector<shared_ptr<T>> pop_all();
 	void show();
 };
 
-template <typename T>
-LFStackRC<T>::~LFStackRC()
+template <typename T, typename Allocator>
+LFStackRC<T, Allocator>::~LFStackRC()
 {
 	while (pop())
 		;
 }
 
-template <typename T>
-void LFStackRC<T>::push(T const& data)
+template <typename T, typename Allocator>
+void LFStackRC<T, Allocator>::push(T const& data)
 {
 	CountedNodePtr newNode;
 	newNode.ptr = new Node(data);
@@ -55,8 +61,35 @@ void LFStackRC<T>::push(T const& data)
 		;
 }
 
-template <typename T>
-void LFStackRC<T>::IncreaseHeadCount(CountedNodePtr& oldCounter)
+// Links the values into a local chain and publishes it with a single CAS,
+// the last value of the range ends up on top as with repeated push()
+template <typename T, typename Allocator>
+template <typename Iterator>
+void LFStackRC<T, Allocator>::push_range(Iterator first, Iterator last)
+{
+	if(first == last)
+		return;
+
+	CountedNodePtr top;
+	top.ptr = new Node(*first);
+	top.externalCount = 1;
+	Node *const bottom = top.ptr;
+	for(++first; first != last; ++first)
+	{
+		CountedNodePtr newNode;
+		newNode.ptr = new Node(*first);
+		newNode.externalCount = 1;
+		newNode.ptr->next = top;
+		top = newNode;
+	}
+
+	bottom->next = head.load();
+	while(!head.compare_exchange_weak(bottom->next, top))
+		;
+}
+
+template <typename T, typename Allocator>
+void LFStackRC<T, Allocator>::IncreaseHeadCount(CountedNodePtr& oldCounter)
 {
 	CountedNodePtr newCounter;
 	do {
@@ -69,8 +102,8 @@ void LFStackRC<T>::IncreaseHeadCount(CountedNodePtr& oldCounter)
 	oldCounter.externalCount = newCounter.externalCount;
 }
 
-template <typename T>
-shared_ptr<T> LFStackRC<T>::pop()
+template <typename T, typename Allocator>
+shared_ptr<T> LFStackRC<T, Allocator>::pop()
 {
 	CountedNodePtr oldHead = head.load();
 
@@ -95,8 +128,32 @@ shared_ptr<T> LFStackRC<T>::pop()
 	}
 }
 
-template <typename T>
-void LFStackRC<T>::show()
+// Detaches the whole stack with one exchange, values come back top first.
+// Unlike pop() no reference was taken on the head, so only the stack's own
+// reference is dropped from every external count.
+template <typename T, typename Allocator>
+vector<shared_ptr<T>> LFStackRC<T, Allocator>::pop_all()
+{
+	CountedNodePtr current = head.exchange(CountedNodePtr{});
+
+	vector<shared_ptr<T>> res;
+	while(Node *const ptr = current.ptr)
+	{
+		CountedNodePtr const next = ptr->next;
+		res.emplace_back();
+		res.back().swap(ptr->data);
+
+		int const countIncrease = current.externalCount - 1;
+		if (ptr->internalCount.fetch_add(countIncrease) == -countIncrease)
+			delete ptr;
+
+		current = next;
+	}
+	return res;
+}
+
+template <typename T, typename Allocator>
+void LFStackRC<T, Allocator>::show()
 {
 	CountedNodePtr h = head.load();
 	Node* n = h.ptr;
@@ -134,5 +191,13 @@ int main()
 	lfstak.show();
 	cout << endl;
 
+	int const batch[] = {20, 21, 22};
+	lfstak.push_range(begin(batch), end(batch));
+
+	cout << "pop_all:";
+	for(shared_ptr<int> const& v : lfstak.pop_all())
+		cout << " " << *v;
+	cout << endl;
+
 	return 0;
 }
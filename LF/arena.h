@@ -0,0 +1,420 @@
+#pragma once
+
+#include <atomic>
+#include <mutex>
+#include <vector>
+#include <new>
+#include <cstddef>
+#include <cstdint>
+
+#if defined(_WIN32)
+#include <windows.h>
+#elif defined(__linux__)
+#include <sys/mman.h>
+#endif
+
+// Node allocation policies for the lock-free containers. A node type derives
+// from AllocatedBy<Allocator>, so the containers keep using plain new/delete
+// and the policy decides where the memory comes from:
+//   HeapAllocator   the general heap, as before
+//   ArenaAllocator  GetNodeArena(), a huge-page backed arena
+
+// Memory is mapped in regions of REGION_SIZE, preferably as explicit huge
+// pages (MAP_HUGETLB / MEM_LARGE_PAGES); when none are reserved it falls
+// back to normal pages with transparent huge pages requested. Each thread
+// bump-allocates from its own BLOCK_SIZE block and keeps freed nodes in
+// per-size free lists, so the fast path touches no shared state.
+//
+// A node is often freed by another thread than the one that allocated it
+// (a consumer, or whoever runs the reclaimer). Once a thread has freed
+// FLUSH_COUNT nodes of a size it passes them on to the shared free list of
+// that size, and a thread whose own lists are empty takes the whole shared
+// list before it carves a new block. Pushing a chain and taking the whole
+// list are both single CAS/exchange steps, so the shared lists are free of
+// ABA. A thread that exits hands its free lists and the rest of its block
+// back to the arena. Nothing is unmapped before Release(), which drops
+// everything at once.
+class HugePageArena
+{
+public:
+	static std::size_t const HUGE_PAGE_SIZE = 2 * 1024 * 1024;
+	static std::size_t const REGION_SIZE = 32 * HUGE_PAGE_SIZE;
+	static std::size_t const BLOCK_SIZE = HUGE_PAGE_SIZE;
+	static std::size_t const GRANULARITY = 16;
+	static std::size_t const MAX_SMALL = 256;
+	static std::size_t const SIZE_CLASSES = MAX_SMALL / GRANULARITY;
+	static std::size_t const FLUSH_COUNT = 64;
+
+	enum PageKind { EXPLICIT_HUGE, TRANSPARENT_HUGE, NORMAL };
+
+	struct Stats
+	{
+		std::size_t regions;
+		std::size_t explicitHuge;
+		std::size_t transparentHuge;
+		std::size_t normal;
+	};
+
+private:
+	struct Region
+	{
+		char *base;
+		std::size_t size;
+		PageKind kind;
+	};
+
+	struct FreeNode
+	{
+		FreeNode *next;
+	};
+
+	struct Span
+	{
+		char *cursor;
+		char *end;
+	};
+
+	// freeLists holds nodes taken from the shared lists, freed the nodes this
+	// thread freed itself since its last flush
+	struct LocalArena
+	{
+		HugePageArena *arena = nullptr;
+		std::uint64_t generation = 0;
+		char *cursor = nullptr;
+		char *end = nullptr;
+		FreeNode *freeLists[SIZE_CLASSES] = {};
+		FreeNode *freed[SIZE_CLASSES] = {};
+		FreeNode *freedLast[SIZE_CLASSES] = {};
+		std::size_t freedCount[SIZE_CLASSES] = {};
+
+		~LocalArena();
+	};
+
+	std::mutex regionsMutex;
+	std::vector<Region> regions;
+	std::vector<Span> spares;
+	char *regionCursor = nullptr;
+	char *regionEnd = nullptr;
+	std::atomic<std::uint64_t> generation{1};
+	std::atomic<FreeNode*> sharedLists[SIZE_CLASSES] = {};
+
+	static Region Map(std::size_t size);
+	static void Unmap(Region const& region);
+
+	LocalArena& Local();
+	void NewBlock(LocalArena& local);
+	void PushShared(std::size_t sizeClass, FreeNode *first, FreeNode *last);
+	void HandBack(LocalArena& local);
+
+	// The thread state is one thread_local for the whole process, so there
+	// may only be the one arena GetNodeArena() returns
+	HugePageArena() = default;
+	friend HugePageArena& GetNodeArena();
+public:
+	HugePageArena(HugePageArena const&) = delete;
+	HugePageArena& operator=(HugePageArena const&) = delete;
+	~HugePageArena();
+
+	void* Allocate(std::size_t size);
+	void Deallocate(void *p, std::size_t size);
+
+	// Every node allocated so far must be dead and no thread may be inside
+	// Allocate/Deallocate
+	void Release();
+
+	Stats GetStats();
+};
+
+inline HugePageArena::Region HugePageArena::Map(std::size_t size)
+{
+	Region region = { nullptr, size, NORMAL };
+#if defined(_WIN32)
+	SIZE_T const large = GetLargePageMinimum();
+	if(large && size % large == 0)
+	{
+		region.base = static_cast<char*>(VirtualAlloc(nullptr, size,
+			MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE));
+		region.kind = EXPLICIT_HUGE;
+	}
+	if(!region.base)
+	{
+		region.base = static_cast<char*>(VirtualAlloc(nullptr, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE));
+		region.kind = NORMAL;
+	}
+	if(!region.base)
+		throw std::bad_alloc();
+#elif defined(__linux__)
+	void *p = MAP_FAILED;
+#if defined(MAP_HUGETLB)
+	p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+	region.kind = EXPLICIT_HUGE;
+#endif
+	if(p == MAP_FAILED)
+	{
+		// Map one huge page more, so the region can start on a huge page boundary
+		std::size_t const padded = size + HUGE_PAGE_SIZE;
+		p = mmap(nullptr, padded, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if(p == MAP_FAILED)
+			throw std::bad_alloc();
+
+		char *const raw = static_cast<char*>(p);
+		std::uintptr_t const aligned = (reinterpret_cast<std::uintptr_t>(raw) + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1);
+		char *const base = reinterpret_cast<char*>(aligned);
+		if(base != raw)
+			munmap(raw, base - raw);
+		if(raw + padded != base + size)
+			munmap(base + size, raw + padded - (base + size));
+		p = base;
+
+		region.kind = NORMAL;
+#if defined(MADV_HUGEPAGE)
+		if(!madvise(p, size, MADV_HUGEPAGE))
+			region.kind = TRANSPARENT_HUGE;
+#endif
+	}
+	region.base = static_cast<char*>(p);
+#else
+	region.base = static_cast<char*>(::operator new(size));
+#endif
+	return region;
+}
+
+inline void HugePageArena::Unmap(Region const& region)
+{
+#if defined(_WIN32)
+	VirtualFree(region.base, 0, MEM_RELEASE);
+#elif defined(__linux__)
+	munmap(region.base, region.size);
+#else
+	::operator delete(region.base);
+#endif
+}
+
+inline HugePageArena::~HugePageArena()
+{
+	for(Region const& region : regions)
+		Unmap(region);
+}
+
+inline HugePageArena::LocalArena::~LocalArena()
+{
+	if(arena)
+		arena->HandBack(*this);
+}
+
+// State of an older generation points into unmapped memory and is dropped
+inline HugePageArena::LocalArena& HugePageArena::Local()
+{
+	thread_local static LocalArena local;
+	std::uint64_t const current = generation.load(std::memory_order_acquire);
+	if(local.generation != current)
+	{
+		local.arena = this;
+		local.generation = current;
+		local.cursor = local.end = nullptr;
+		for(std::size_t i = 0; i < SIZE_CLASSES; i++)
+		{
+			local.freeLists[i] = local.freed[i] = local.freedLast[i] = nullptr;
+			local.freedCount[i] = 0;
+		}
+	}
+	return local;
+}
+
+// Blocks left over by exited threads are used up before new ones are carved
+inline void HugePageArena::NewBlock(LocalArena& local)
+{
+	std::lock_guard<std::mutex> lock(regionsMutex);
+	if(!spares.empty())
+	{
+		local.cursor = spares.back().cursor;
+		local.end = spares.back().end;
+		spares.pop_back();
+		return;
+	}
+	if(regionCursor == regionEnd)
+	{
+		Region const region = Map(REGION_SIZE);
+		regions.push_back(region);
+		regionCursor = region.base;
+		regionEnd = region.base + region.size;
+	}
+	local.cursor = regionCursor;
+	local.end = regionCursor + BLOCK_SIZE;
+	regionCursor += BLOCK_SIZE;
+}
+
+inline void HugePageArena::PushShared(std::size_t sizeClass, FreeNode *first, FreeNode *last)
+{
+	std::atomic<FreeNode*> &head = sharedLists[sizeClass];
+	last->next = head.load(std::memory_order_relaxed);
+	while(!head.compare_exchange_weak(last->next, first, std::memory_order_release, std::memory_order_relaxed))
+		;
+}
+
+// Called when a thread exits. Release() may have dropped its state since.
+inline void HugePageArena::HandBack(LocalArena& local)
+{
+	if(local.generation != generation.load(std::memory_order_acquire))
+		return;
+	for(std::size_t i = 0; i < SIZE_CLASSES; i++)
+	{
+		if(local.freed[i])
+			PushShared(i, local.freed[i], local.freedLast[i]);
+		if(FreeNode *const first = local.freeLists[i])
+		{
+			FreeNode *last = first;
+			while(last->next)
+				last = last->next;
+			PushShared(i, first, last);
+		}
+	}
+	if(local.cursor != local.end)
+	{
+		std::lock_guard<std::mutex> lock(regionsMutex);
+		spares.push_back(Span{local.cursor, local.end});
+	}
+	local.generation = 0;
+}
+
+inline void* HugePageArena::Allocate(std::size_t size)
+{
+	if(!size)
+		size = 1;
+	if(size > MAX_SMALL)
+		return ::operator new(size);
+
+	std::size_t const rounded = (size + GRANULARITY - 1) & ~(GRANULARITY - 1);
+	std::size_t const sizeClass = rounded / GRANULARITY - 1;
+	LocalArena &local = Local();
+
+	// The nodes this thread freed last are the most likely to be in cache
+	if(FreeNode *const node = local.freed[sizeClass])
+	{
+		local.freed[sizeClass] = node->next;
+		if(!node->next)
+			local.freedLast[sizeClass] = nullptr;
+		local.freedCount[sizeClass]--;
+		return node;
+	}
+
+	FreeNode *&freeList = local.freeLists[sizeClass];
+	if(!freeList && sharedLists[sizeClass].load(std::memory_order_relaxed))
+		freeList = sharedLists[sizeClass].exchange(nullptr, std::memory_order_acquire);
+	if(FreeNode *const node = freeList)
+	{
+		freeList = node->next;
+		return node;
+	}
+
+	if(static_cast<std::size_t>(local.end - local.cursor) < rounded)
+		NewBlock(local);
+	void *const p = local.cursor;
+	local.cursor += rounded;
+	return p;
+}
+
+// The node joins the free list of the thread that deletes it, which passes
+// it on to the shared list once FLUSH_COUNT have piled up
+inline void HugePageArena::Deallocate(void *p, std::size_t size)
+{
+	if(!p)
+		return;
+	if(!size)
+		size = 1;
+	if(size > MAX_SMALL)
+	{
+		::operator delete(p);
+		return;
+	}
+
+	std::size_t const rounded = (size + GRANULARITY - 1) & ~(GRANULARITY - 1);
+	std::size_t const sizeClass = rounded / GRANULARITY - 1;
+	LocalArena &local = Local();
+	FreeNode *const node = static_cast<FreeNode*>(p);
+	node->next = local.freed[sizeClass];
+	if(!node->next)
+		local.freedLast[sizeClass] = node;
+	local.freed[sizeClass] = node;
+	if(++local.freedCount[sizeClass] == FLUSH_COUNT)
+	{
+		PushShared(sizeClass, node, local.freedLast[sizeClass]);
+		local.freed[sizeClass] = local.freedLast[sizeClass] = nullptr;
+		local.freedCount[sizeClass] = 0;
+	}
+}
+
+inline void HugePageArena::Release()
+{
+	std::lock_guard<std::mutex> lock(regionsMutex);
+	generation.fetch_add(1, std::memory_order_acq_rel);
+	for(std::atomic<FreeNode*>& head : sharedLists)
+		head.store(nullptr, std::memory_order_relaxed);
+	for(Region const& region : regions)
+		Unmap(region);
+	regions.clear();
+	spares.clear();
+	regionCursor = regionEnd = nullptr;
+}
+
+inline HugePageArena::Stats HugePageArena::GetStats()
+{
+	std::lock_guard<std::mutex> lock(regionsMutex);
+	Stats stats = { regions.size(), 0, 0, 0 };
+	for(Region const& region : regions)
+	{
+		if(region.kind == EXPLICIT_HUGE)
+			stats.explicitHuge++;
+		else if(region.kind == TRANSPARENT_HUGE)
+			stats.transparentHuge++;
+		else
+			stats.normal++;
+	}
+	return stats;
+}
+
+inline HugePageArena& GetNodeArena()
+{
+	static HugePageArena arena;
+	return arena;
+}
+
+struct HeapAllocator
+{
+	static void* Allocate(std::size_t size)
+	{
+		return ::operator new(size);
+	}
+
+	static void Deallocate(void *p, std::size_t)
+	{
+		::operator delete(p);
+	}
+};
+
+struct ArenaAllocator
+{
+	static void* Allocate(std::size_t size)
+	{
+		return GetNodeArena().Allocate(size);
+	}
+
+	static void Deallocate(void *p, std::size_t size)
+	{
+		GetNodeArena().Deallocate(p, size);
+	}
+};
+
+template <typename Allocator>
+struct AllocatedBy
+{
+	static void* operator new(std::size_t size)
+	{
+		return Allocator::Allocate(size);
+	}
+
+	static void operator delete(void *p, std::size_t size)
+	{
+		Allocator::Deallocate(p, size);
+	}
+};
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <cstdint>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+// Index of the lowest / highest set bit of a non-zero mask, shared by the
+// hazard slot bitmaps, the timer wheel and the account table
+inline unsigned LowestSetBit(std::uint64_t mask)
+{
+#if defined(_MSC_VER) && defined(_M_X64)
+	unsigned long index;
+	_BitScanForward64(&index, mask);
+	return index;
+#elif defined(_MSC_VER)
+	unsigned long index;
+	if(_BitScanForward(&index, static_cast<unsigned long>(mask)))
+		return index;
+	_BitScanForward(&index, static_cast<unsigned long>(mask >> 32));
+	return index + 32;
+#else
+	return __builtin_ctzll(mask);
+#endif
+}
+
+inline unsigned HighestSetBit(std::uint64_t mask)
+{
+#if defined(_MSC_VER) && defined(_M_X64)
+	unsigned long index;
+	_BitScanReverse64(&index, mask);
+	return index;
+#elif defined(_MSC_VER)
+	unsigned long index;
+	if(_BitScanReverse(&index, static_cast<unsigned long>(mask >> 32)))
+		return index + 32;
+	_BitScanReverse(&index, static_cast<unsigned long>(mask));
+	return index;
+#else
+	return 63 - __builtin_clzll(mask);
+#endif
+}
@@ -0,0 +1,143 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+
+#include "../Blocking/Stack/locks.h"
+
+// Lets a consumer of a lock-free container sleep until something changes
+// without putting a lock on the producer side:
+//
+//   EventCount::Key key = ec.prepare_wait();
+//   if(condition holds)  ec.cancel_wait();
+//   else                 ec.commit_wait(key);
+//
+// Producers call notify_one()/notify_all() after publishing. When nobody is
+// waiting that costs a fence and a load, the futex is only touched for
+// sleeping consumers. Both return whether a consumer was asleep in
+// commit_wait; one that is only between prepare_wait and commit_wait or
+// cancel_wait still gets the notification but does not count.
+class EventCount
+{
+	std::atomic<int> epoch{0};
+	std::atomic<int> waiters{0};
+	std::atomic<int> sleepers{0};
+public:
+	typedef int Key;
+
+	EventCount() = default;
+	EventCount(EventCount const&) = delete;
+	EventCount& operator=(EventCount const&) = delete;
+
+	Key prepare_wait()
+	{
+		waiters.fetch_add(1, std::memory_order_seq_cst);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		return epoch.load(std::memory_order_acquire);
+	}
+
+	void cancel_wait()
+	{
+		waiters.fetch_sub(1, std::memory_order_relaxed);
+	}
+
+	void commit_wait(Key key)
+	{
+		if(epoch.load(std::memory_order_acquire) != key)
+		{
+			waiters.fetch_sub(1, std::memory_order_relaxed);
+			return;
+		}
+		sleepers.fetch_add(1, std::memory_order_seq_cst);
+		while(epoch.load(std::memory_order_seq_cst) == key)
+			FutexWait(epoch, key);
+		sleepers.fetch_sub(1, std::memory_order_relaxed);
+		waiters.fetch_sub(1, std::memory_order_relaxed);
+	}
+
+	// false if the deadline passed before a notification
+	bool commit_wait_until(Key key, std::chrono::steady_clock::time_point deadline)
+	{
+		bool notified = epoch.load(std::memory_order_acquire) != key;
+		if(!notified)
+		{
+			sleepers.fetch_add(1, std::memory_order_seq_cst);
+			while(!(notified = epoch.load(std::memory_order_seq_cst) != key))
+			{
+				auto const now = std::chrono::steady_clock::now();
+				if(now >= deadline)
+					break;
+				FutexWaitFor(epoch, key, deadline - now);
+			}
+			sleepers.fetch_sub(1, std::memory_order_relaxed);
+		}
+		waiters.fetch_sub(1, std::memory_order_relaxed);
+		return notified;
+	}
+
+	// A sleeper counts itself before the futex compares the epoch, so either
+	// it is seen here or its futex wait sees the new epoch and returns
+	bool notify_one()
+	{
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		if(!waiters.load(std::memory_order_relaxed))
+			return false;
+		epoch.fetch_add(1, std::memory_order_seq_cst);
+		if(!sleepers.load(std::memory_order_seq_cst))
+			return false;
+		FutexWakeOne(epoch);
+		return true;
+	}
+
+	bool notify_all()
+	{
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		if(!waiters.load(std::memory_order_relaxed))
+			return false;
+		epoch.fetch_add(1, std::memory_order_seq_cst);
+		if(!sleepers.load(std::memory_order_seq_cst))
+			return false;
+		FutexWakeAll(epoch);
+		return true;
+	}
+};
+
+// Blocking pop on top of a non-blocking one: tryPop() returns an empty
+// pointer when the container is empty, producers notify ec after a push
+template <typename TryPop>
+auto WaitPop(EventCount& ec, TryPop tryPop) -> decltype(tryPop())
+{
+	for(;;)
+	{
+		if(auto res = tryPop())
+			return res;
+
+		EventCount::Key const key = ec.prepare_wait();
+		if(auto res = tryPop())
+		{
+			ec.cancel_wait();
+			return res;
+		}
+		ec.commit_wait(key);
+	}
+}
+
+template <typename TryPop, typename Rep, typename Period>
+auto WaitPopFor(EventCount& ec, TryPop tryPop, std::chrono::duration<Rep, Period> const& timeout) -> decltype(tryPop())
+{
+	auto const deadline = std::chrono::steady_clock::now() + timeout;
+	for(;;)
+	{
+		if(auto res = tryPop())
+			return res;
+
+		EventCount::Key const key = ec.prepare_wait();
+		if(auto res = tryPop())
+		{
+			ec.cancel_wait();
+			return res;
+		}
+		if(!ec.commit_wait_until(key, deadline))
+			return tryPop();
+	}
+}
@@ -0,0 +1,125 @@
+#pragma once
+
+#include <atomic>
+#include <string>
+#include <cstdint>
+
+#include "../../LF/bits.h"
+#include "../../LF/HashMap/split_ordered_map.h"
+
+namespace messaging
+{
+
+// Compact handle of an interned account name. Messages carry this instead
+// of the name, so sending one allocates nothing for the account and the
+// bank finds an account by index.
+struct account_id
+{
+	std::uint32_t value;
+
+	bool operator==(account_id other) const
+	{
+		return value == other.value;
+	}
+
+	bool operator!=(account_id other) const
+	{
+		return value != other.value;
+	}
+};
+
+// Gives every account name one account_id for the lifetime of the process.
+// Names are looked up in the lock-free split-ordered map, so any thread can
+// intern without taking a lock. The way back goes through an append-only
+// array of segments indexed by id: segment k holds ids 2^k - 1 to
+// 2^(k+1) - 2, and a segment is allocated by whoever needs it first.
+//
+// When two threads intern the same new name at once, both draw an id and
+// the one whose insert loses leaves its id unused.
+class account_table
+{
+	// Id 2^32 - 1 lands in segment 32
+	static unsigned const max_segments = 33;
+
+	typedef std::atomic<std::string const*> slot;
+
+	LFHashMap<std::string, std::uint32_t> ids;
+	std::atomic<slot*> segments[max_segments];
+	std::atomic<std::uint32_t> next_id;
+
+	account_table() : next_id(0)
+	{
+		for (unsigned i = 0; i < max_segments; ++i)
+			segments[i].store(nullptr, std::memory_order_relaxed);
+	}
+
+	account_table(account_table const&) = delete;
+	account_table& operator=(account_table const&) = delete;
+
+	static unsigned segment_of(std::uint32_t id)
+	{
+		return HighestSetBit(std::uint64_t(id) + 1);
+	}
+
+	slot& slot_of(std::uint32_t id)
+	{
+		unsigned const segment = segment_of(id);
+		slot* s = segments[segment].load(std::memory_order_acquire);
+		if (!s)
+		{
+			std::size_t const size = std::size_t(1) << segment;
+			slot* const fresh = new slot[size];
+			for (std::size_t i = 0; i < size; ++i)
+				fresh[i].store(nullptr, std::memory_order_relaxed);
+			if (segments[segment].compare_exchange_strong(s, fresh,
+				std::memory_order_acq_rel, std::memory_order_acquire))
+				s = fresh;
+			else
+				delete[] fresh;
+		}
+		return s[std::uint64_t(id) + 1 - (std::uint64_t(1) << segment)];
+	}
+
+public:
+	~account_table()
+	{
+		for (unsigned i = 0; i < max_segments; ++i)
+		{
+			slot* const s = segments[i].load();
+			if (!s)
+				continue;
+			std::size_t const size = std::size_t(1) << i;
+			for (std::size_t j = 0; j < size; ++j)
+				delete s[j].load();
+			delete[] s;
+		}
+	}
+
+	static account_table& instance()
+	{
+		static account_table table;
+		return table;
+	}
+
+	account_id intern(std::string const& name)
+	{
+		std::uint32_t id;
+		if (ids.find(name, id))
+			return account_id{id};
+
+		// The name is in place before the id can be found
+		std::uint32_t const fresh = next_id.fetch_add(1);
+		slot_of(fresh).store(new std::string(name), std::memory_order_release);
+		if (ids.insert(name, fresh))
+			return account_id{fresh};
+		ids.find(name, id);
+		return account_id{id};
+	}
+
+	std::string const& name(account_id id)
+	{
+		return *slot_of(id.value).load(std::memory_order_acquire);
+	}
+};
+
+}
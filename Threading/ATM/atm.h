@@ -1,5 +1,7 @@
 #pragma once
 
+#include <chrono>
+
 #include "sender.h"
 #include "messages.h"
 #include "receiver.h"
@@ -10,31 +12,28 @@ namespace messaging
 
 class atm
 {
+	static std::size_t const keypad_capacity = 32;
+
 	messaging::receiver incoming;
+	messaging::sender keypad;
 	messaging::sender bank;
 	messaging::sender interface_hardware;
 
 	void (atm::*state)();
 
-	std::string account;
+	messaging::account_id account;
 	unsigned withdrawal_amount;
 	std::string pin;
+	messaging::reply_future bank_reply;
 
+	// The states below wait while a bank request is outstanding. The reply
+	// is taken by the continuation of the request, which picks the next
+	// state and ends the wait; cancelling drops the reply instead.
 	void process_withdrawal()
 	{
-		incoming.wait().handle<withdraw_ok>([&](withdraw_ok const& msg)
-			{
-				interface_hardware.send(issue_money(withdrawal_amount));
-				bank.send(withdrawal_processed(account, withdrawal_amount));
-				state = &atm::done_processing;
-			}
-		).handle<withdraw_denied>([&](withdraw_denied const& msg)
-			{
-				interface_hardware.send(display_insufficient_funds());
-				state = &atm::done_processing;
-			}
-		).handle<cancel_pressed>([&](cancel_pressed const& msg)
+		incoming.wait().handle<cancel_pressed>([&](cancel_pressed const& msg)
 			{
+				bank_reply.cancel();
 				bank.send(cancel_withdrawal(account, withdrawal_amount));
 				interface_hardware.send(display_withdrawal_cancelled());
 				state = &atm::done_processing;
@@ -44,13 +43,9 @@ class atm
 
 	void process_balance()
 	{
-		incoming.wait().handle<balance>([&](balance const& msg)
-			{
-				interface_hardware.send(display_balance(msg.amount));
-				state = &atm::wait_for_action;
-			}
-		).handle<cancel_pressed>([&](cancel_pressed const& msg)
+		incoming.wait().handle<cancel_pressed>([&](cancel_pressed const& msg)
 			{
+				bank_reply.cancel();
 				state = &atm::done_processing;
 			}
 		);
@@ -62,12 +57,28 @@ class atm
 		incoming.wait().handle<withdraw_pressed>([&](withdraw_pressed const& msg)
 			{
 				withdrawal_amount = msg.amount;
-				bank.send(withdraw(account, msg.amount, incoming));
+				bank_reply = incoming.request<withdraw>(bank, account, msg.amount)
+					.then<withdraw_ok>([this](withdraw_ok const&)
+					{
+						interface_hardware.send(issue_money(withdrawal_amount));
+						bank.send(withdrawal_processed(account, withdrawal_amount));
+						state = &atm::done_processing;
+					})
+					.then<withdraw_denied>([this](withdraw_denied const&)
+					{
+						interface_hardware.send(display_insufficient_funds());
+						state = &atm::done_processing;
+					});
 				state = &atm::process_withdrawal;
 			}
 		).handle<balance_pressed>([&](balance_pressed const& msg)
 			{
-				bank.send(get_balance(account, incoming));
+				bank_reply = incoming.request<get_balance>(bank, account)
+					.then<balance>([this](balance const& reply)
+					{
+						interface_hardware.send(display_balance(reply.amount));
+						state = &atm::wait_for_action;
+					});
 				state = &atm::process_balance;
 			}
 		).handle<cancel_pressed>([&](cancel_pressed const& msg)
@@ -79,32 +90,41 @@ class atm
 
 	void verifying_pin()
 	{
-		incoming.wait().handle<pin_verified>([&](pin_verified const& msg)
-			{
-				state = &atm::wait_for_action;
-			}
-		).handle<pin_incorrect>([&](pin_incorrect const& msg)
+		std::chrono::seconds const bank_deadline(5);
+		incoming.wait_for(bank_deadline).handle<cancel_pressed>([&](cancel_pressed const& msg)
 			{
-				interface_hardware.send(
-					display_pin_incorrect_message());
+				bank_reply.cancel();
 				state = &atm::done_processing;
 			}
-		).handle<cancel_pressed>([&](cancel_pressed const& msg)
+		).handle<receive_timeout>([&](receive_timeout const& msg)
 			{
+				bank_reply.cancel();
+				interface_hardware.send(display_timed_out());
 				state = &atm::done_processing;
 			}
 		);
 	}
 
+	// The timeout restarts with every key press
 	void getting_pin()
 	{
-		incoming.wait().handle<digit_pressed>([&](digit_pressed const& msg)
+		std::chrono::seconds const idle_timeout(30);
+		incoming.wait_for(idle_timeout).handle<digit_pressed>([&](digit_pressed const& msg)
 			{
 				unsigned const pin_length = 4;
 				pin += msg.digit;
 				if (pin.length() == pin_length)
 				{
-					bank.send(verify_pin(account, pin, incoming));
+					bank_reply = incoming.request<verify_pin>(bank, account, pin)
+						.then<pin_verified>([this](pin_verified const&)
+						{
+							state = &atm::wait_for_action;
+						})
+						.then<pin_incorrect>([this](pin_incorrect const&)
+						{
+							interface_hardware.send(display_pin_incorrect_message());
+							state = &atm::done_processing;
+						});
 					state = &atm::verifying_pin;
 				}
 			}
@@ -119,6 +139,11 @@ class atm
 			{
 				state = &atm::done_processing;
 			}
+		).handle<receive_timeout>([&](receive_timeout const& msg)
+			{
+				interface_hardware.send(display_timed_out());
+				state = &atm::done_processing;
+			}
 		);
 	}
 
@@ -127,6 +152,9 @@ class atm
 		interface_hardware.send(display_enter_card());
 		incoming.wait().handle<card_inserted>([&](card_inserted const& msg)
 			{
+				// Key presses stashed before the card went in belong to no
+				// session
+				incoming.discard_stash();
 				account = msg.account;
 				pin = "";
 				interface_hardware.send(display_enter_pin());
@@ -146,7 +174,7 @@ class atm
 
 public:
 	atm(messaging::sender bank_,messaging::sender interface_hardware_) :
-		bank(bank_), interface_hardware(interface_hardware_)
+		keypad(incoming.add_mailbox(keypad_capacity, messaging::overflow_block)), bank(bank_), interface_hardware(interface_hardware_)
 	{}
 
 	void done()
@@ -157,16 +185,9 @@ public:
 	void run()
 	{
 		state = &atm::waiting_for_card;
-		try
-		{
-			for (;;)
-			{
-				(this->*state)();
-			}
-		}
-
-		catch (messaging::close_queue const&)
+		while (!incoming.closed())
 		{
+			(this->*state)();
 		}
 	}
 
@@ -174,6 +195,15 @@ public:
 	{
 		return incoming;
 	}
+
+	// Card and key presses have a mailbox of their own, so a flood of them
+	// does not contend with the bank replies on one lock. It is bounded: the
+	// input loop waits while it is full, only cancel_pressed always gets
+	// through.
+	messaging::sender get_input_sender()
+	{
+		return keypad;
+	}
 };
 
 }
\ No newline at end of file
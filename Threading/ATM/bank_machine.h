@@ -1,79 +1,134 @@
 #pragma once
 
+#include <functional>
+#include <thread>
+#include <vector>
+
 #include "messages.h"
 #include "receiver.h"
 #include "template_dispatcher.h"
+#include "pool.h"
+#include "qsbr.h"
 
 namespace messaging
 {
 
-unsigned bank_machine_balance;
-
-class bank_machine
+// Balances of all accounts, shared by the workers of the bank and indexed
+// by account id. An account starts with 199.
+//
+// Balance queries far outnumber withdrawals, so the balances are an
+// immutable snapshot behind a qsbr_pointer: a query is a plain load, and a
+// withdrawal installs a changed copy. Both may only be called from inside
+// a handler, where the dispatch loop keeps the worker online.
+class ledger
 {
-	messaging::receiver incoming;
-	
+	static unsigned const initial_balance = 199;
+
+	qsbr_pointer<std::vector<unsigned> > balances;
 public:
-	bank_machine(){
-		bank_machine_balance = 199;
+	ledger() : balances(new std::vector<unsigned>)
+	{}
+
+	unsigned balance(account_id account)
+	{
+		std::vector<unsigned> const& current = *balances.read();
+		return account.value < current.size() ? current[account.value] : initial_balance;
 	}
 
-	void done()
+	bool withdraw(account_id account, unsigned amount)
 	{
-		get_sender().send(messaging::close_queue());
+		// Balances only go down, so a refusal needs no new copy
+		if (balance(account) < amount)
+			return false;
+
+		unsigned const initial = initial_balance;
+		bool done = false;
+		balances.modify([&](std::vector<unsigned>& b)
+			{
+				if (account.value >= b.size())
+					b.resize(account.value + 1, initial);
+				done = b[account.value] >= amount;
+				if (done)
+					b[account.value] -= amount;
+			}
+		);
+		return done;
 	}
+};
 
-	void run()
+// The bank is served by a pool of workers that all run the same handlers.
+// With key affinity every account is served by one worker, so its requests
+// are handled in the order the atm sent them.
+class bank_machine
+{
+	messaging::worker_pool pool;
+	ledger accounts;
+
+	void serve(messaging::receiver& incoming)
 	{
-		try
+		while (!incoming.closed())
 		{
-			for (;;)
-			{
-				incoming.wait().handle<verify_pin>([&](verify_pin const& msg)
+			incoming.wait().handle<verify_pin>([&](verify_pin const& msg)
+				{
+					if (msg.pin == "1937")
 					{
-						if (msg.pin == "1937")
-						{
-							msg.atm_queue.send(pin_verified());
-						}
-						else
-						{
-							msg.atm_queue.send(pin_incorrect());
-						}
+						msg.atm_queue.send(pin_verified());
 					}
-				).handle<withdraw>([&](withdraw const& msg)
+					else
 					{
-						if (bank_machine_balance >= msg.amount)
-						{
-							msg.atm_queue.send(::withdraw_ok());
-							bank_machine_balance -= msg.amount;
-						}
-						else
-						{
-							msg.atm_queue.send(withdraw_denied());
-						}
+						msg.atm_queue.send(pin_incorrect());
 					}
-				).handle<get_balance>([&](get_balance const& msg)
+				}
+			).handle<withdraw>([&](withdraw const& msg)
+				{
+					if (accounts.withdraw(msg.account, msg.amount))
 					{
-						msg.atm_queue.send(::balance(bank_machine_balance));
+						msg.atm_queue.send(::withdraw_ok());
 					}
-				).handle<withdrawal_processed>([&](withdrawal_processed const& msg)
+					else
 					{
+						msg.atm_queue.send(withdraw_denied());
 					}
-				).handle<cancel_withdrawal>([&](cancel_withdrawal const& msg)
-					{
-					}
-				);
-			}
-		}
-		catch (messaging::close_queue const&)
-		{
+				}
+			).handle<get_balance>([&](get_balance const& msg)
+				{
+					msg.atm_queue.send(::balance(accounts.balance(msg.account)));
+				}
+			).handle<withdrawal_processed>([&](withdrawal_processed const& msg)
+				{
+				}
+			).handle<cancel_withdrawal>([&](cancel_withdrawal const& msg)
+				{
+				}
+			);
 		}
 	}
 
+public:
+	explicit bank_machine(std::size_t workers = 1, bool key_affinity = true) :
+		pool(workers, key_affinity)
+	{}
+
+	void done()
+	{
+		pool.done();
+	}
+
+	// Serves on the calling thread and on workers - 1 more
+	void run()
+	{
+		std::vector<std::thread> threads;
+		for (std::size_t i = 1; i < pool.size(); ++i)
+			threads.emplace_back(&bank_machine::serve, this, std::ref(pool.worker(i)));
+		serve(pool.worker(0));
+		for (std::thread& t : threads)
+			t.join();
+	}
+
 	messaging::sender get_sender()
 	{
-		return incoming;
+		return pool.get_sender();
 	}
 };
 
-}
\ No newline at end of file
+}
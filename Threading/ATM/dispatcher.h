@@ -1,16 +1,188 @@
 #pragma once
 
+#include <cstdint>
+
 #include "queue.h"
+#include "qsbr.h"
+#include "timer_wheel.h"
+#include "stash.h"
+#include "request.h"
+#include "select.h"
 
 namespace messaging
 {
 
+template<typename PreviousDispatcher, typename Msg, typename Func>
+class TemplateDispatcher;
+
 class close_queue
 {};
 
+template<>
+struct message_lane<close_queue> : in_lane<lane_control>
+{};
+
+// Delivered to a chain started with receiver::wait_for when nothing it
+// handles arrived in time. It travels in the normal lane, so messages that
+// arrived before the deadline are still dispatched first.
+struct receive_timeout
+{
+	std::uint64_t id;
+	explicit receive_timeout(std::uint64_t id_) : id(id_)
+	{}
+};
+
+// What dispatch tells the chain about one message
+enum dispatch_status
+{
+	dispatch_unmatched,
+	dispatch_handled,
+	dispatch_close
+};
+
+// Lifetime of a receiver. close_queue starts a drain: the messages already
+// queued are still dispatched and counted, and the first wait that finds
+// the queue empty closes the receiver instead of blocking. The actor loop
+// stops when receiver::closed() says so, nothing is thrown.
+struct receiver_state
+{
+	bool closing = false;
+	bool closed = false;
+	std::size_t drained = 0;
+	std::size_t discarded = 0;
+};
+
+// What a dispatch chain waits on: the actor's mailboxes, timers, stash,
+// open requests and state, and the id of the receive_timeout this chain
+// accepts, 0 for none
+struct receive_context
+{
+	mailbox_set* mailboxes;
+	timer_wheel* timers;
+	stash* stashed;
+	reply_table* replies;
+	receiver_state* state;
+	std::uint64_t timeout_id;
+};
+
+// A message no handler of the chain matched is kept for a later chain,
+// except for a timeout, which only means something to the chain that armed it
+inline void stash_unmatched(receive_context const& ctx, std::shared_ptr<message_base> msg)
+{
+	if (!dynamic_cast<wrapped_message<receive_timeout>*>(msg.get()))
+		ctx.stashed->put(std::move(msg));
+}
+
+// Returning to the queue is a quiescent state for the actor thread, and
+// blocking on an empty queue takes it offline. Timers that are due push
+// their messages first; while the queue is empty the thread sleeps until a
+// message arrives or the next timer is due. A receive_timeout left over from
+// an earlier wait is dropped here. While draining, an empty queue ends the
+// wait with nullptr.
+inline std::shared_ptr<message_base> wait_and_pop_quiescent(receive_context const& ctx)
+{
+	qsbr_domain& qsbr = qsbr_domain::instance();
+	qsbr.quiescent_state();
+	std::shared_ptr<message_base> msg;
+	for (;;)
+	{
+		if (ctx.state->closing)
+		{
+			if (!ctx.mailboxes->try_pop(msg))
+				return nullptr;
+		}
+		else
+		{
+			ctx.timers->advance(timer_wheel::clock::now());
+			if (!ctx.mailboxes->try_pop(msg))
+			{
+				timer_wheel::clock::time_point wake;
+				qsbr.offline();
+				if (ctx.timers->next_expiry(wake))
+				{
+					if (!ctx.mailboxes->wait_and_pop_until(wake, msg))
+						msg.reset();
+				}
+				else
+				{
+					msg = ctx.mailboxes->wait_and_pop();
+				}
+				qsbr.online();
+				if (!msg)
+					continue;
+			}
+		}
+
+		wrapped_message<receive_timeout>* const timeout =
+			dynamic_cast<wrapped_message<receive_timeout>*>(msg.get());
+		if (!timeout || timeout->contents.id == ctx.timeout_id)
+			return msg;
+	}
+}
+
+// The wait of a whole handle<> chain, run by its last dispatcher: one
+// message is dispatched or one reply completes its request, or the receiver
+// closes. Replies never reach the chain, and a reply to a request that is
+// no longer open is dropped. Messages still stashed when the receiver
+// closes are counted as discarded.
+template<typename Chain>
+void wait_and_dispatch(Chain& chain, receive_context const& ctx)
+{
+	receiver_state& state = *ctx.state;
+	if (state.closed)
+		return;
+
+	if (stash::bucket* const b = chain.oldest_stashed())
+	{
+		chain.dispatch(ctx.stashed->take(*b));
+		if (state.closing)
+			++state.drained;
+		return;
+	}
+
+	for (;;)
+	{
+		auto msg = wait_and_pop_quiescent(ctx);
+		if (!msg)
+		{
+			state.discarded += ctx.stashed->size();
+			ctx.stashed->clear();
+			state.closed = true;
+			return;
+		}
+
+		if (wrapped_message<reply_envelope>* const reply =
+			dynamic_cast<wrapped_message<reply_envelope>*>(msg.get()))
+		{
+			if (ctx.replies->complete(reply->contents))
+			{
+				if (state.closing)
+					++state.drained;
+				return;
+			}
+			continue;
+		}
+
+		switch (chain.dispatch(msg))
+		{
+		case dispatch_handled:
+			if (state.closing)
+				++state.drained;
+			return;
+		case dispatch_close:
+			state.closing = true;
+			break;
+		case dispatch_unmatched:
+			stash_unmatched(ctx, std::move(msg));
+			break;
+		}
+	}
+}
+
 class dispatcher
 {
-	queue* q;
+	receive_context ctx;
+	timer_wheel::handle timeout;
 	bool chained;
 
 	dispatcher(dispatcher const&) = delete;
@@ -19,44 +191,53 @@ class dispatcher
 	template<typename Dispatcher, typename Msg, typename Func>
 	friend class TemplateDispatcher;
 
-	void wait_and_dispatch()
+	template<typename Chain>
+	friend void wait_and_dispatch(Chain& chain, receive_context const& ctx);
+
+	stash::bucket* oldest_stashed()
 	{
-		for (;;)
-		{
-			auto msg = q->wait_and_pop();
-			dispatch(msg);
-		}
+		return nullptr;
 	}
 
-	bool dispatch(std::shared_ptr<message_base> const& msg)
+	dispatch_status dispatch(std::shared_ptr<message_base> const& msg)
 	{
 		if (dynamic_cast<wrapped_message<close_queue>*>(msg.get()))
 		{
-			throw close_queue();
+			return dispatch_close;
 		}
-		return false;
+		return dispatch_unmatched;
 	}
 public:
-	dispatcher(dispatcher&& other) : q(other.q), chained(other.chained)
+	dispatcher(dispatcher&& other) :
+		ctx(other.ctx), timeout(other.timeout), chained(other.chained)
 	{
+		other.timeout = timer_wheel::handle();
 		other.chained = true;
 	}
 
-	explicit dispatcher(queue* q_) : q(q_), chained(false)
+	explicit dispatcher(receive_context const& ctx_,
+		timer_wheel::handle timeout_ = timer_wheel::handle()) :
+		ctx(ctx_), timeout(timeout_), chained(false)
 	{}
 
 	template<typename Message, typename Func>
 	TemplateDispatcher<dispatcher, Message, Func>
 	handle(Func&& f)
 	{
-		return TemplateDispatcher<dispatcher, Message, Func>(q, this, std::forward<Func>(f));
+		return TemplateDispatcher<dispatcher, Message, Func>(ctx, this, std::forward<Func>(f));
 	}
 
-	~dispatcher() noexcept(false)
+	// The chain is destroyed after it dispatched a message, the timeout
+	// armed by wait_for is no longer needed then
+	~dispatcher()
 	{
-		if (!chained)
+		if (chained)
+		{
+			ctx.timers->cancel(timeout);
+		}
+		else
 		{
-			wait_and_dispatch();
+			wait_and_dispatch(*this, ctx);
 		}
 	}
 };
@@ -1,5 +1,7 @@
 #include "stdafx.h"
 
+#include <thread>
+
 #include "bank_machine.h"
 #include "interface_machine.h"
 #include "atm.h"
@@ -8,13 +10,13 @@ using namespace messaging;
 
 int main()
 {
-	bank_machine bank;
+	bank_machine bank(4);
 	interface_machine interface_hardware;
 	atm machine(bank.get_sender(), interface_hardware.get_sender());
 	std::thread bank_thread(&bank_machine::run, &bank);
 	std::thread if_thread(&interface_machine::run, &interface_hardware);
 	std::thread atm_thread(&atm::run, &machine);
-	messaging::sender atmqueue(machine.get_sender());
+	messaging::sender atmqueue(machine.get_input_sender());
 	bool quit_pressed = false;
 	while (!quit_pressed)
 	{
@@ -1,15 +1,19 @@
 #pragma once
 
+#include <string>
+
 #include "sender.h"
+#include "request.h"
+#include "accounts.h"
 
 
 struct withdraw
 {
-	std::string account;
+	messaging::account_id account;
 	unsigned amount;
-	mutable messaging::sender atm_queue;
+	mutable messaging::reply_to atm_queue;
 
-	withdraw(std::string const& account_, unsigned amount_, messaging::sender atm_queue_) :
+	withdraw(messaging::account_id account_, unsigned amount_, messaging::reply_to atm_queue_) :
 		account(account_), amount(amount_), atm_queue(atm_queue_)
 	{}
 };
@@ -20,9 +24,9 @@ struct withdraw_denied {};
 
 struct cancel_withdrawal
 {
-	std::string account;
+	messaging::account_id account;
 	unsigned amount;
-	cancel_withdrawal(std::string const& account_,
+	cancel_withdrawal(messaging::account_id account_,
 		unsigned amount_) :
 		account(account_), amount(amount_)
 	{}
@@ -30,19 +34,21 @@ struct cancel_withdrawal
 
 struct withdrawal_processed
 {
-	std::string account;
+	messaging::account_id account;
 	unsigned amount;
-	withdrawal_processed(std::string const& account_,
+	withdrawal_processed(messaging::account_id account_,
 		unsigned amount_) :
 		account(account_), amount(amount_)
 	{}
 };
 
+// The account name read from the card is interned here, everything after
+// it carries the id
 struct card_inserted
 {
-	std::string account;
+	messaging::account_id account;
 	explicit card_inserted(std::string const& account_) :
-		account(account_)
+		account(messaging::account_table::instance().intern(account_))
 	{}
 };
 
@@ -78,11 +84,11 @@ struct issue_money
 
 struct verify_pin
 {
-	std::string account;
+	messaging::account_id account;
 	std::string pin;
-	mutable messaging::sender atm_queue;
-	verify_pin(std::string const& account_, std::string const& pin_,
-		messaging::sender atm_queue_) :
+	mutable messaging::reply_to atm_queue;
+	verify_pin(messaging::account_id account_, std::string const& pin_,
+		messaging::reply_to atm_queue_) :
 		account(account_), pin(pin_), atm_queue(atm_queue_)
 	{}
 };
@@ -103,11 +109,13 @@ struct display_pin_incorrect_message {};
 
 struct display_withdrawal_options {};
 
+struct display_timed_out {};
+
 struct get_balance
 {
-	std::string account;
-	mutable messaging::sender atm_queue;
-	get_balance(std::string const& account_, messaging::sender atm_queue_) :
+	messaging::account_id account;
+	mutable messaging::reply_to atm_queue;
+	get_balance(messaging::account_id account_, messaging::reply_to atm_queue_) :
 		account(account_), atm_queue(atm_queue_)
 	{}
 };
@@ -129,3 +137,30 @@ struct display_balance
 };
 
 struct balance_pressed {};
+
+namespace messaging
+{
+
+// Cancelling must not wait behind queued key presses. Replies from the bank
+// come back as reply_envelope, which has the high lane already.
+template<> struct message_lane<cancel_pressed> : in_lane<lane_control> {};
+
+// Everything the bank does for one account is handled in order by one of
+// its workers
+template<typename Msg>
+struct account_key
+{
+	static bool get(Msg const& msg, std::size_t& key)
+	{
+		key = msg.account.value;
+		return true;
+	}
+};
+
+template<> struct affinity_key<withdraw> : account_key<withdraw> {};
+template<> struct affinity_key<cancel_withdrawal> : account_key<cancel_withdrawal> {};
+template<> struct affinity_key<withdrawal_processed> : account_key<withdrawal_processed> {};
+template<> struct affinity_key<verify_pin> : account_key<verify_pin> {};
+template<> struct affinity_key<get_balance> : account_key<get_balance> {};
+
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <memory>
+#include <vector>
+
+#include "queue.h"
+#include "sender.h"
+#include "receiver.h"
+
+namespace messaging
+{
+
+// N identical workers behind one mailbox. Each worker is a receiver of its
+// own, run on its own thread, that also consumes the shared queue of the
+// pool, so the next message sent to the pool is taken by whichever worker
+// is free and one slow handler no longer holds up the others.
+//
+// With key affinity the sender of the pool puts a message that has an
+// affinity_key into the own queue of worker key % N instead. All messages
+// with one key are then handled by one worker, in the order they were sent.
+// Messages without a key still go to the shared queue.
+//
+// done() closes every worker. A closing worker still takes messages from
+// the shared queue until it is empty, so nothing sent before is lost.
+class worker_pool
+{
+	queue shared;
+	std::vector<std::unique_ptr<receiver> > workers;
+	std::vector<queue*> affine;
+	bool key_affinity;
+
+	worker_pool(worker_pool const&) = delete;
+	worker_pool& operator=(worker_pool const&) = delete;
+
+public:
+	explicit worker_pool(std::size_t count, bool key_affinity_ = false) :
+		key_affinity(key_affinity_)
+	{
+		for (std::size_t i = 0; i < count; ++i)
+		{
+			workers.emplace_back(new receiver);
+			workers.back()->attach_mailbox(shared);
+			affine.push_back(&workers.back()->mailboxes.primary());
+		}
+	}
+
+	std::size_t size() const
+	{
+		return workers.size();
+	}
+
+	receiver& worker(std::size_t index)
+	{
+		return *workers[index];
+	}
+
+	// Bounds the shared queue, see basic_queue::set_capacity
+	void set_capacity(std::size_t capacity, overflow_policy policy)
+	{
+		shared.set_capacity(capacity, policy);
+	}
+
+	sender get_sender()
+	{
+		return key_affinity ? sender(&shared, &affine) : sender(&shared);
+	}
+
+	void done()
+	{
+		for (std::unique_ptr<receiver>& w : workers)
+			sender(*w).send(close_queue());
+	}
+};
+
+}
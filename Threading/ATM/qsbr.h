@@ -0,0 +1,240 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <cstdint>
+
+namespace messaging
+{
+
+// Quiescent state based reclamation for data shared between actors.
+//
+// The dispatch loop announces a quiescent state every time it goes back to
+// the queue for the next message, and goes offline while it blocks on an
+// empty queue. Handlers may therefore read shared lock-free data with plain
+// loads, as long as no pointer obtained inside a handler outlives it.
+class qsbr_domain
+{
+	struct thread_record
+	{
+		std::atomic<std::uint64_t> seen;
+		std::atomic<bool> in_use;
+		thread_record* next;
+	};
+
+	struct retired_pointer
+	{
+		void* data;
+		void (*deleter)(void*);
+		std::uint64_t stamp;
+	};
+
+	class thread_state
+	{
+		qsbr_domain& domain;
+		thread_record* record;
+	public:
+		std::vector<retired_pointer> retired;
+
+		explicit thread_state(qsbr_domain& domain_) :
+			domain(domain_), record(domain_.acquire_record())
+		{}
+
+		~thread_state()
+		{
+			record->seen.store(0, std::memory_order_release);
+			if (!retired.empty())
+			{
+				domain.reclaim(retired);
+				domain.orphan(retired);
+			}
+			record->in_use.store(false, std::memory_order_release);
+		}
+
+		thread_record& get_record()
+		{
+			return *record;
+		}
+	};
+
+	std::atomic<std::uint64_t> counter;
+	std::atomic<thread_record*> records;
+	std::mutex orphans_mutex;
+	std::vector<retired_pointer> orphans;
+	std::atomic<bool> has_orphans;
+
+	qsbr_domain() : counter(1), records(nullptr), has_orphans(false)
+	{}
+
+	qsbr_domain(qsbr_domain const&) = delete;
+	qsbr_domain& operator=(qsbr_domain const&) = delete;
+
+	template<typename T>
+	static void do_delete(void* p)
+	{
+		delete static_cast<T*>(p);
+	}
+
+	thread_record* acquire_record()
+	{
+		for (thread_record* r = records.load(std::memory_order_acquire); r; r = r->next)
+		{
+			bool expected = false;
+			if (!r->in_use.load(std::memory_order_relaxed) &&
+				r->in_use.compare_exchange_strong(expected, true))
+			{
+				return r;
+			}
+		}
+
+		thread_record* const r = new thread_record;
+		r->seen.store(0, std::memory_order_relaxed);
+		r->in_use.store(true, std::memory_order_relaxed);
+		r->next = records.load(std::memory_order_relaxed);
+		while (!records.compare_exchange_weak(r->next, r,
+			std::memory_order_release, std::memory_order_relaxed))
+			;
+		return r;
+	}
+
+	thread_state& local()
+	{
+		thread_local static thread_state state(*this);
+		return state;
+	}
+
+	// Pairs with the fence in online(): either a thread coming online is seen
+	// here, or its first load already sees the pointer that replaced ours
+	std::uint64_t oldest_seen()
+	{
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		std::uint64_t oldest = counter.load();
+		for (thread_record* r = records.load(std::memory_order_acquire); r; r = r->next)
+		{
+			std::uint64_t const seen = r->seen.load(std::memory_order_acquire);
+			if (seen && seen < oldest)
+				oldest = seen;
+		}
+		return oldest;
+	}
+
+	static void delete_expired(std::vector<retired_pointer>& retired, std::uint64_t safe)
+	{
+		std::size_t kept = 0;
+		for (retired_pointer const& p : retired)
+		{
+			if (p.stamp <= safe)
+				p.deleter(p.data);
+			else
+				retired[kept++] = p;
+		}
+		retired.resize(kept);
+	}
+
+	void reclaim(std::vector<retired_pointer>& retired)
+	{
+		std::uint64_t const safe = oldest_seen();
+		delete_expired(retired, safe);
+
+		if (has_orphans.load(std::memory_order_relaxed))
+		{
+			std::lock_guard<std::mutex> lk(orphans_mutex);
+			delete_expired(orphans, safe);
+			has_orphans.store(!orphans.empty(), std::memory_order_relaxed);
+		}
+	}
+
+	void orphan(std::vector<retired_pointer>& retired)
+	{
+		if (retired.empty())
+			return;
+		std::lock_guard<std::mutex> lk(orphans_mutex);
+		orphans.insert(orphans.end(), retired.begin(), retired.end());
+		has_orphans.store(true, std::memory_order_relaxed);
+		retired.clear();
+	}
+
+public:
+	static qsbr_domain& instance()
+	{
+		static qsbr_domain domain;
+		return domain;
+	}
+
+	void quiescent_state()
+	{
+		thread_state& state = local();
+		state.get_record().seen.store(counter.load(std::memory_order_acquire),
+			std::memory_order_release);
+		if (!state.retired.empty() || has_orphans.load(std::memory_order_relaxed))
+			reclaim(state.retired);
+	}
+
+	void online()
+	{
+		local().get_record().seen.store(counter.load());
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+	}
+
+	void offline()
+	{
+		local().get_record().seen.store(0, std::memory_order_release);
+	}
+
+	template<typename T>
+	void retire(T* p)
+	{
+		retired_pointer const r = { p, &do_delete<T>, counter.fetch_add(1) + 1 };
+		local().retired.push_back(r);
+	}
+};
+
+// Single pointer published to readers running inside handlers, replaced
+// copies are reclaimed once every online actor has passed a quiescent state
+template<typename T>
+class qsbr_pointer
+{
+	std::atomic<T*> p;
+
+	qsbr_pointer(qsbr_pointer const&) = delete;
+	qsbr_pointer& operator=(qsbr_pointer const&) = delete;
+public:
+	explicit qsbr_pointer(T* initial = nullptr) : p(initial)
+	{}
+
+	~qsbr_pointer()
+	{
+		delete p.load();
+	}
+
+	T const* read() const
+	{
+		return p.load(std::memory_order_acquire);
+	}
+
+	void update(std::unique_ptr<T> value)
+	{
+		if (T* const old = p.exchange(value.release(), std::memory_order_acq_rel))
+			qsbr_domain::instance().retire(old);
+	}
+
+	template<typename Func>
+	void modify(Func f)
+	{
+		T* old = p.load(std::memory_order_acquire);
+		std::unique_ptr<T> copy;
+		do
+		{
+			copy.reset(old ? new T(*old) : new T());
+			f(*copy);
+		} while (!p.compare_exchange_weak(old, copy.get(),
+			std::memory_order_acq_rel, std::memory_order_acquire));
+		copy.release();
+		if (old)
+			qsbr_domain::instance().retire(old);
+	}
+};
+
+}
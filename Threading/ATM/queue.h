@@ -2,8 +2,16 @@
 
 #include <mutex>
 #include <condition_variable>
-#include <queue>
+#include <chrono>
+#include <deque>
+#include <typeinfo>
+#include <vector>
 #include <memory>
+#include <type_traits>
+#include <atomic>
+
+#include "../../Blocking/Stack/locks.h"
+#include "../../LF/eventcount.h"
 
 namespace messaging
 {
@@ -21,29 +29,311 @@ struct wrapped_message : message_base
 	{}
 };
 
-class queue
+// Mailbox lanes, drained in this order. A message type goes to
+// lane_normal unless message_lane is specialized for it, so the lane is
+// fixed at compile time by the type the sender sends.
+enum lane
+{
+	lane_control,
+	lane_high,
+	lane_normal,
+	lane_count
+};
+
+template<lane L>
+struct in_lane
+{
+	static lane const value = L;
+};
+
+template<typename Msg>
+struct message_lane : in_lane<lane_normal>
+{};
+
+// What a bounded queue does with a message that does not fit: the sender
+// waits for room, the message is refused, the oldest message of the lowest
+// non-empty lane is dropped to make room, or the message replaces the
+// newest queued one of its type and is refused when there is none.
+// Coalescing suits mailboxes of updates where only the latest value of a
+// type matters; replies to requests all have one type and must not share
+// a coalescing mailbox.
+enum overflow_policy
 {
-	std::mutex m;
-	std::condition_variable c;
-	std::queue<std::shared_ptr<message_base> > q;
+	overflow_block,
+	overflow_fail,
+	overflow_drop_oldest,
+	overflow_coalesce
+};
+
+// Depth gauges of one queue, read together under its lock
+struct queue_stats
+{
+	std::size_t depth;
+	std::size_t high_water;
+	std::size_t refused;
+	std::size_t dropped;
+	std::size_t coalesced;
+	std::size_t blocked;	// sends that had to wait for room
+};
+
+// Lock is std::mutex or one of TicketLock, MCSLock, HybridLock
+//
+// The consumer takes the first message of the highest non-empty lane, but a
+// lane that has been passed over max_passed times in a row while it had
+// messages is served next, so bulk traffic keeps moving under a steady
+// stream of control messages.
+//
+// A queue is unbounded until set_capacity gives it a capacity. Then at most
+// that many high and normal lane messages are queued, and the overflow
+// policy decides what happens to one more. The control lane is never
+// bounded, so close_queue and cancelling always get through.
+template<typename Lock = std::mutex>
+class basic_queue
+{
+	typedef typename std::conditional<std::is_same<Lock, std::mutex>::value,
+		std::condition_variable, std::condition_variable_any>::type condition;
+
+	static unsigned const max_passed = 8;
+
+	enum admission
+	{
+		admission_queued,
+		admission_refused,
+		admission_replaced
+	};
+
+	Lock m;
+	condition c;
+	condition not_full;
+	std::vector<EventCount*> wakeups;
+	std::atomic<std::size_t> next_wakeup;
+	std::deque<std::shared_ptr<message_base> > q[lane_count];
+	unsigned passed[lane_count] = {};
+	std::size_t capacity;
+	overflow_policy policy;
+	unsigned waiting_senders;
+	queue_stats gauges;
+
+	bool empty() const
+	{
+		for (unsigned l = 0; l < lane_count; ++l)
+			if (!q[l].empty())
+				return false;
+		return true;
+	}
+
+	std::size_t bounded_depth() const
+	{
+		std::size_t depth = 0;
+		for (unsigned l = lane_control + 1; l < lane_count; ++l)
+			depth += q[l].size();
+		return depth;
+	}
+
+	bool full() const
+	{
+		return capacity && bounded_depth() >= capacity;
+	}
+
+	admission admit_locked(lane l, std::shared_ptr<message_base>& msg,
+		std::unique_lock<Lock>& lk, bool may_block)
+	{
+		if (l == lane_control || !full())
+			return admission_queued;
+
+		switch (policy)
+		{
+		case overflow_block:
+			if (!may_block)
+				break;
+			++gauges.blocked;
+			++waiting_senders;
+			not_full.wait(lk, [&] {return !full(); });
+			--waiting_senders;
+			return admission_queued;
+		case overflow_fail:
+			break;
+		case overflow_drop_oldest:
+			for (unsigned d = lane_count; d-- > lane_control + 1; )
+			{
+				if (!q[d].empty())
+				{
+					q[d].pop_front();
+					--gauges.depth;
+					++gauges.dropped;
+					return admission_queued;
+				}
+			}
+			break;
+		case overflow_coalesce:
+			for (auto it = q[l].rbegin(); it != q[l].rend(); ++it)
+			{
+				if (typeid(**it) == typeid(*msg))
+				{
+					*it = std::move(msg);
+					++gauges.coalesced;
+					return admission_replaced;
+				}
+			}
+			break;
+		}
+		++gauges.refused;
+		return admission_refused;
+	}
+
+	bool enqueue(lane l, std::shared_ptr<message_base> msg, bool bounded, bool may_block)
+	{
+		{
+			std::unique_lock<Lock> lk(m);
+			admission const a = bounded ? admit_locked(l, msg, lk, may_block) : admission_queued;
+			if (a != admission_queued)
+				return a == admission_replaced;
+			q[l].push_back(std::move(msg));
+			if (++gauges.depth > gauges.high_water)
+				gauges.high_water = gauges.depth;
+		}
+		c.notify_one();
+		wake_consumer();
+		return true;
+	}
+
+	// One sleeping consumer is enough for a message: the first event count
+	// with a consumer asleep is woken, starting at a different one every
+	// time. Counts passed on the way whose consumer is only about to sleep
+	// are notified as well, so it cannot miss the message either.
+	void wake_consumer()
+	{
+		std::size_t const count = wakeups.size();
+		if (!count)
+			return;
+		std::size_t const first = count == 1 ? 0 :
+			next_wakeup.fetch_add(1, std::memory_order_relaxed) % count;
+		for (std::size_t i = 0; i < count; ++i)
+		{
+			if (wakeups[(first + i) % count]->notify_one())
+				return;
+		}
+	}
+
+	std::shared_ptr<message_base> pop_locked()
+	{
+		unsigned chosen = lane_count;
+		for (unsigned l = lane_count; l-- > 1; )
+		{
+			if (!q[l].empty() && passed[l] >= max_passed)
+			{
+				chosen = l;
+				break;
+			}
+		}
+		if (chosen == lane_count)
+		{
+			chosen = 0;
+			while (q[chosen].empty())
+				++chosen;
+		}
+
+		passed[chosen] = 0;
+		for (unsigned l = chosen + 1; l < lane_count; ++l)
+			if (!q[l].empty())
+				++passed[l];
+
+		auto res = std::move(q[chosen].front());
+		q[chosen].pop_front();
+		--gauges.depth;
+		// Blocked senders are woken once half the room is free rather than
+		// on every pop, so they are not switched in for one message each
+		if (waiting_senders && bounded_depth() <= capacity / 2)
+			not_full.notify_all();
+		return res;
+	}
 public:
+	basic_queue() : next_wakeup(0), capacity(0), policy(overflow_block),
+		waiting_senders(0), gauges()
+	{}
+
+	// false when the message was refused
+	template<typename T>
+	bool push(T const& msg)
+	{
+		return push_wrapped(message_lane<T>::value, std::make_shared<wrapped_message<T> >(msg));
+	}
 
+	// Like push, but refuses the message instead of waiting for room
 	template<typename T>
-	void push(T const& msg)
+	bool try_push(T const& msg)
+	{
+		return enqueue(message_lane<T>::value, std::make_shared<wrapped_message<T> >(msg), true, false);
+	}
+
+	// Ignores the capacity. For what an actor queues for itself from its
+	// own thread: waiting for room only that thread can make never ends.
+	template<typename T>
+	void push_unbounded(T const& msg)
+	{
+		enqueue(message_lane<T>::value, std::make_shared<wrapped_message<T> >(msg), false, false);
+	}
+
+	// Queues a message the caller already wrapped, e.g. one that several
+	// queues share
+	bool push_wrapped(lane l, std::shared_ptr<message_base> msg)
+	{
+		return enqueue(l, std::move(msg), true, true);
+	}
+
+	// 0 makes the queue unbounded again. Messages queued beyond a smaller
+	// capacity stay.
+	void set_capacity(std::size_t capacity_, overflow_policy policy_)
+	{
+		std::lock_guard<Lock> lk(m);
+		capacity = capacity_;
+		policy = policy_;
+		not_full.notify_all();
+	}
+
+	queue_stats stats()
+	{
+		std::lock_guard<Lock> lk(m);
+		return gauges;
+	}
+
+	// Pushes also wake a consumer blocked on ec, so one consumer can block
+	// on several queues at once, and several consumers on one queue. Only
+	// while setting up, before the queue is used from more than one thread.
+	void add_wakeup(EventCount* ec)
 	{
-		std::lock_guard<std::mutex> lk(m);
-		q.push(std::make_shared<wrapped_message<T> >(msg));
-		c.notify_all();
+		wakeups.push_back(ec);
+	}
+
+	bool try_pop(std::shared_ptr<message_base>& res)
+	{
+		std::lock_guard<Lock> lk(m);
+		if (empty())
+			return false;
+		res = pop_locked();
+		return true;
 	}
 
 	std::shared_ptr<message_base> wait_and_pop()
 	{
-		std::unique_lock<std::mutex> lk(m);
-		c.wait(lk, [&] {return !q.empty(); });
-		auto res = q.front();
-		q.pop();
-		return res;
+		std::unique_lock<Lock> lk(m);
+		c.wait(lk, [&] {return !empty(); });
+		return pop_locked();
+	}
+
+	// false when nothing arrived by the deadline
+	template<typename Clock, typename Duration>
+	bool wait_and_pop_until(std::chrono::time_point<Clock, Duration> const& deadline,
+		std::shared_ptr<message_base>& res)
+	{
+		std::unique_lock<Lock> lk(m);
+		if (!c.wait_until(lk, deadline, [&] {return !empty(); }))
+			return false;
+		res = pop_locked();
+		return true;
 	}
 };
 
+typedef basic_queue<> queue;
+
 }
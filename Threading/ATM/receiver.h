@@ -1,24 +1,154 @@
 #pragma once
 
+#include <chrono>
+#include <cstdint>
+#include <utility>
+
 #include "queue.h"
 #include "sender.h"
 #include "dispatcher.h"
+#include "timer_wheel.h"
+#include "stash.h"
+#include "request.h"
+#include "select.h"
 
 namespace messaging
 {
 
+// The timers, the stash and the open requests belong to the thread that
+// runs the dispatch loop: everything but the conversion to sender is only
+// called from that thread, typically from inside a handler
 class receiver
 {
-	queue q;
+	mailbox_set mailboxes;
+	timer_wheel timers;
+	stash stashed;
+	reply_table replies;
+	receiver_state state;
+	std::uint64_t last_timeout_id = 0;
+
+	friend class worker_pool;
 public:
 	operator sender()
 	{
-		return sender(&q);
+		return sender(&mailboxes.primary());
 	}
 
 	dispatcher wait()
 	{
-		return dispatcher(&q);
+		return dispatcher(receive_context{&mailboxes, &timers, &stashed, &replies, &state, 0});
+	}
+
+	// Like wait, but the chain gets a receive_timeout if nothing it handles
+	// arrives within d
+	template<typename Rep, typename Period>
+	dispatcher wait_for(std::chrono::duration<Rep, Period> const& d)
+	{
+		std::uint64_t const id = ++last_timeout_id;
+		queue* const target = &mailboxes.primary();
+		timer_wheel::handle const h = timers.schedule_after(d, [target, id]
+			{
+				target->push_unbounded(receive_timeout(id));
+			});
+		return dispatcher(receive_context{&mailboxes, &timers, &stashed, &replies, &state, id}, h);
+	}
+
+	// Delivers msg to this receiver after d
+	template<typename Message, typename Rep, typename Period>
+	timer_wheel::handle send_after(std::chrono::duration<Rep, Period> const& d, Message const& msg)
+	{
+		queue* const target = &mailboxes.primary();
+		return timers.schedule_after(d, [target, msg]
+			{
+				target->push_unbounded(msg);
+			});
+	}
+
+	bool cancel_timer(timer_wheel::handle h)
+	{
+		return timers.cancel(h);
+	}
+
+	// Bounds the receiver's own mailbox, 0 leaves it unbounded. The
+	// receiver's timers ignore the capacity, they run on the actor thread.
+	void set_capacity(std::size_t capacity, overflow_policy policy)
+	{
+		mailboxes.primary().set_capacity(capacity, policy);
+	}
+
+	// Another mailbox for this receiver, waits select from all of them.
+	// Giving a high-rate source its own mailbox keeps it off the lock of the
+	// others. Called before the sender is handed out, by the actor thread or
+	// before it starts.
+	sender add_mailbox(std::size_t capacity = 0, overflow_policy policy = overflow_block)
+	{
+		return sender(&mailboxes.add(capacity, policy));
+	}
+
+	// Makes this receiver one of the consumers of a queue it shares with
+	// other receivers, each message is taken by one of them. Called while
+	// setting up, like add_mailbox.
+	void attach_mailbox(queue& shared)
+	{
+		mailboxes.attach(shared);
+	}
+
+	// Gauges of mailbox 'box', 0 is the receiver's own
+	queue_stats mailbox_stats(std::size_t box = 0)
+	{
+		return mailboxes.box(box).stats();
+	}
+
+	// Sends Request(args..., return address) to target. The reply completes
+	// the future returned here, through whatever wait this receiver is in
+	// when it arrives, so any number of requests can be outstanding.
+	template<typename Request, typename... Args>
+	reply_future request(sender target, Args&&... args)
+	{
+		std::uint64_t const id = replies.open();
+		target.send(Request(std::forward<Args>(args)..., reply_to(sender(&mailboxes.primary()), id)));
+		return reply_future(&replies, id);
+	}
+
+	std::size_t outstanding() const
+	{
+		return replies.size();
+	}
+
+	// Drops stashed messages that no later state should see
+	template<typename Message>
+	void discard_stashed()
+	{
+		stashed.discard<Message>();
+	}
+
+	void discard_stash()
+	{
+		stashed.clear();
+	}
+
+	std::size_t stashed_count() const
+	{
+		return stashed.size();
+	}
+
+	// True once close_queue arrived and everything queued before it was
+	// dispatched; every wait returns at once from then on
+	bool closed() const
+	{
+		return state.closed;
+	}
+
+	// Messages dispatched after close_queue, and messages that were never
+	// dispatched because no state handled them before the receiver closed
+	std::size_t drained() const
+	{
+		return state.drained;
+	}
+
+	std::size_t discarded() const
+	{
+		return state.discarded;
 	}
 };
 
@@ -0,0 +1,225 @@
+#pragma once
+
+#include <functional>
+#include <memory>
+#include <type_traits>
+#include <vector>
+#include <cstdint>
+
+#include "queue.h"
+#include "sender.h"
+
+namespace messaging
+{
+
+// A reply on its way back, wrapped with the correlation id of the request
+// it answers. Replies unblock an actor that waits for them, so they travel
+// in the high lane whatever their payload is.
+struct reply_envelope
+{
+	std::uint64_t id;
+	std::shared_ptr<message_base> payload;
+};
+
+template<>
+struct message_lane<reply_envelope> : in_lane<lane_high>
+{};
+
+// Return address a request message carries. The handler answers through it
+// with send(), as it would through a sender.
+class reply_to
+{
+	sender target;
+	std::uint64_t id;
+public:
+	reply_to() : id(0)
+	{}
+
+	reply_to(sender target_, std::uint64_t id_) : target(target_), id(id_)
+	{}
+
+	template<typename Message>
+	void send(Message const& msg)
+	{
+		target.send(reply_envelope{id, std::make_shared<wrapped_message<Message>>(msg)});
+	}
+};
+
+// Requests of one actor that still wait for their reply. A correlation id
+// is the index of a slot in the low half and the generation of the slot in
+// the high half, so a reply finds its continuations with one array access.
+// A slot moves to its next generation when the request is answered or
+// cancelled, and a late reply to it is dropped.
+//
+// Only the thread that runs the actor's dispatch loop touches the table.
+class reply_table
+{
+public:
+	typedef std::function<bool(message_base*)> continuation;
+
+private:
+	struct slot
+	{
+		std::uint32_t generation;
+		bool open;
+		std::vector<continuation> continuations;
+	};
+
+	std::vector<slot> slots;
+	std::vector<std::uint32_t> free_slots;
+	std::size_t count = 0;
+
+	slot* find(std::uint64_t id)
+	{
+		std::uint64_t const index = id & 0xffffffffu;
+		if (index >= slots.size())
+			return nullptr;
+		slot& s = slots[static_cast<std::size_t>(index)];
+		if (!s.open || s.generation != (id >> 32))
+			return nullptr;
+		return &s;
+	}
+
+	// Generation 0 is never used, so no request has id 0
+	void release(slot& s)
+	{
+		s.open = false;
+		if (!++s.generation)
+			s.generation = 1;
+		free_slots.push_back(static_cast<std::uint32_t>(&s - slots.data()));
+		--count;
+	}
+
+public:
+	std::uint64_t open()
+	{
+		std::uint32_t index;
+		if (free_slots.empty())
+		{
+			index = static_cast<std::uint32_t>(slots.size());
+			slots.push_back(slot{1, false, std::vector<continuation>()});
+		}
+		else
+		{
+			index = free_slots.back();
+			free_slots.pop_back();
+		}
+		slot& s = slots[index];
+		s.open = true;
+		++count;
+		return (std::uint64_t(s.generation) << 32) | index;
+	}
+
+	bool add(std::uint64_t id, continuation c)
+	{
+		slot* const s = find(id);
+		if (!s)
+			return false;
+		s->continuations.push_back(std::move(c));
+		return true;
+	}
+
+	// false when the request was already answered or cancelled
+	bool cancel(std::uint64_t id)
+	{
+		slot* const s = find(id);
+		if (!s)
+			return false;
+		s->continuations.clear();
+		release(*s);
+		return true;
+	}
+
+	bool is_open(std::uint64_t id)
+	{
+		return find(id) != nullptr;
+	}
+
+	// Closes the request and runs the first continuation that takes the
+	// type of the payload. The slot is free again before that runs, so a
+	// continuation may make new requests. false when the request is no
+	// longer open and the reply was dropped.
+	bool complete(reply_envelope const& reply)
+	{
+		slot* const s = find(reply.id);
+		if (!s)
+			return false;
+		std::vector<continuation> run;
+		run.swap(s->continuations);
+		release(*s);
+		for (continuation& c : run)
+		{
+			if (c(reply.payload.get()))
+				break;
+		}
+		return true;
+	}
+
+	std::size_t size() const
+	{
+		return count;
+	}
+};
+
+template<typename Reply, typename Func>
+struct typed_continuation
+{
+	Func f;
+
+	bool operator()(message_base* msg)
+	{
+		if (wrapped_message<Reply>* wrapper = dynamic_cast<wrapped_message<Reply>*>(msg))
+		{
+			f(wrapper->contents);
+			return true;
+		}
+		return false;
+	}
+};
+
+// What receiver::request returns for one outstanding request. then<Reply>
+// adds the continuation for one type of reply. Continuations run on the
+// actor's thread, inside the wait that pops the reply, and that wait then
+// returns as if one of its handlers had run. A reply of a type no
+// continuation takes completes the request all the same.
+class reply_future
+{
+	reply_table* table;
+	std::uint64_t correlation;
+public:
+	reply_future() : table(nullptr), correlation(0)
+	{}
+
+	reply_future(reply_table* table_, std::uint64_t correlation_) :
+		table(table_), correlation(correlation_)
+	{}
+
+	template<typename Reply, typename Func>
+	reply_future& then(Func&& f)
+	{
+		if (table)
+		{
+			table->add(correlation, typed_continuation<Reply, typename std::decay<Func>::type>{
+				std::forward<Func>(f)});
+		}
+		return *this;
+	}
+
+	// The reply will be dropped when it arrives
+	bool cancel()
+	{
+		return table && table->cancel(correlation);
+	}
+
+	bool pending() const
+	{
+		return table && table->is_open(correlation);
+	}
+
+	std::uint64_t id() const
+	{
+		return correlation;
+	}
+};
+
+}
@@ -0,0 +1,134 @@
+#pragma once
+
+#include <chrono>
+#include <memory>
+#include <vector>
+
+#include "queue.h"
+#include "../../LF/eventcount.h"
+
+namespace messaging
+{
+
+// The mailboxes one receiver selects from. Box 0 is the receiver's own
+// queue and always exists; every added box is a queue with its own lock, so
+// producers of different mailboxes never contend with each other. A box can
+// also be a queue owned elsewhere that several receivers consume together
+// (worker_pool).
+//
+// With a single box the consumer blocks on that queue as before. Once there
+// are more, every box also notifies an event count of this set, and the
+// consumer blocks on that instead. Boxes are polled round robin starting
+// after the one that gave the last message, so a busy mailbox cannot starve
+// the others; the lanes order messages within one box only.
+//
+// Only the actor thread pops. Boxes are added while setting up, before
+// their senders are handed out.
+class mailbox_set
+{
+	queue own;
+	std::vector<std::unique_ptr<queue> > added;
+	std::vector<queue*> boxes;
+	EventCount ready;
+	std::size_t next;
+
+	mailbox_set(mailbox_set const&) = delete;
+	mailbox_set& operator=(mailbox_set const&) = delete;
+
+	void select(queue& box)
+	{
+		if (boxes.size() == 1)
+			own.add_wakeup(&ready);
+		box.add_wakeup(&ready);
+		boxes.push_back(&box);
+	}
+
+public:
+	mailbox_set() : next(0)
+	{
+		boxes.push_back(&own);
+	}
+
+	queue& primary()
+	{
+		return own;
+	}
+
+	queue& add(std::size_t capacity, overflow_policy policy)
+	{
+		added.emplace_back(new queue);
+		added.back()->set_capacity(capacity, policy);
+		select(*added.back());
+		return *added.back();
+	}
+
+	void attach(queue& box)
+	{
+		select(box);
+	}
+
+	queue& box(std::size_t index)
+	{
+		return *boxes[index];
+	}
+
+	std::size_t size() const
+	{
+		return boxes.size();
+	}
+
+	bool try_pop(std::shared_ptr<message_base>& res)
+	{
+		std::size_t const count = boxes.size();
+		for (std::size_t i = 0; i < count; ++i)
+		{
+			std::size_t const box = (next + i) % count;
+			if (boxes[box]->try_pop(res))
+			{
+				next = box + 1;
+				return true;
+			}
+		}
+		return false;
+	}
+
+	std::shared_ptr<message_base> wait_and_pop()
+	{
+		if (boxes.size() == 1)
+			return own.wait_and_pop();
+
+		std::shared_ptr<message_base> res;
+		for (;;)
+		{
+			EventCount::Key const key = ready.prepare_wait();
+			if (try_pop(res))
+			{
+				ready.cancel_wait();
+				return res;
+			}
+			ready.commit_wait(key);
+		}
+	}
+
+	// false when nothing arrived by the deadline
+	bool wait_and_pop_until(std::chrono::steady_clock::time_point deadline,
+		std::shared_ptr<message_base>& res)
+	{
+		if (boxes.size() == 1)
+			return own.wait_and_pop_until(deadline, res);
+
+		for (;;)
+		{
+			EventCount::Key const key = ready.prepare_wait();
+			if (try_pop(res))
+			{
+				ready.cancel_wait();
+				return true;
+			}
+			if (!ready.commit_wait_until(key, deadline))
+				return try_pop(res);
+		}
+	}
+};
+
+}
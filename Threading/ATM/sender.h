@@ -1,25 +1,71 @@
 #pragma once
 
+#include <vector>
 
 #include "queue.h"
 
 namespace messaging
 {
 
+// Key of a message that must always reach the same worker of a pool with
+// key affinity (see worker_pool). Message types without one are taken by
+// whichever worker is free.
+template<typename Msg>
+struct affinity_key
+{
+	static bool get(Msg const&, std::size_t&)
+	{
+		return false;
+	}
+};
+
 class sender
 {
 	queue*q;
+	std::vector<queue*> const* affine;
+
+	template<typename Message>
+	queue* route(Message const& msg) const
+	{
+		std::size_t key;
+		if (affine && affinity_key<Message>::get(msg, key))
+			return (*affine)[key % affine->size()];
+		return q;
+	}
 public:
-	sender() : q(nullptr) {}
+	sender() : q(nullptr), affine(nullptr) {}
+
+	explicit sender(queue*q_) : q(q_), affine(nullptr) {}
 
-	explicit sender(queue*q_) : q(q_) {}
+	// Messages with an affinity key go to affine_[key % size], all others
+	// to q_
+	sender(queue*q_, std::vector<queue*> const* affine_) : q(q_), affine(affine_) {}
 
 	template<typename Message>
 	void send(Message const& msg)
 	{
-		if (q)
+		if (queue* const target = route(msg))
+		{
+			target->push(msg);
+		}
+	}
+
+	// Never waits for room in a bounded mailbox, false when the message was
+	// refused
+	template<typename Message>
+	bool try_send(Message const& msg)
+	{
+		queue* const target = route(msg);
+		return target && target->try_push(msg);
+	}
+
+	// The wrapper is queued as it is, every receiver it goes to shares it
+	template<typename Message>
+	void send_wrapped(std::shared_ptr<wrapped_message<Message> > const& msg)
+	{
+		if (queue* const target = route(msg->contents))
 		{
-			q->push(msg);
+			target->push_wrapped(message_lane<Message>::value, msg);
 		}
 	}
 };
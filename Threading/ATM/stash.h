@@ -0,0 +1,97 @@
+#pragma once
+
+#include <deque>
+#include <memory>
+#include <typeindex>
+#include <typeinfo>
+#include <unordered_map>
+#include <cstdint>
+
+#include "queue.h"
+
+namespace messaging
+{
+
+// Messages the current handle<> chain did not match, kept for a later chain
+// instead of being dropped (selective receive, as in Erlang).
+//
+// Every message type has its own FIFO bucket, so a chain looks at one
+// bucket front per type it handles rather than rescanning everything that
+// was put aside. A sequence number per message lets the chain take the
+// oldest one across its types. A bucket keeps at most max_per_type
+// messages and drops its oldest beyond that, so a type no state ever
+// handles cannot grow without bound.
+class stash
+{
+public:
+	static std::size_t const max_per_type = 64;
+
+	struct entry
+	{
+		std::uint64_t seq;
+		std::shared_ptr<message_base> msg;
+	};
+
+	typedef std::deque<entry> bucket;
+
+private:
+	std::unordered_map<std::type_index, bucket> buckets;
+	std::uint64_t next_seq = 0;
+	std::size_t count = 0;
+
+public:
+	void put(std::shared_ptr<message_base> msg)
+	{
+		bucket& b = buckets[std::type_index(typeid(*msg))];
+		if (b.size() == max_per_type)
+		{
+			b.pop_front();
+			--count;
+		}
+		b.push_back(entry{next_seq++, std::move(msg)});
+		++count;
+	}
+
+	// The bucket of Msg when it holds anything, nullptr otherwise
+	template<typename Msg>
+	bucket* find()
+	{
+		if (!count)
+			return nullptr;
+		auto const it = buckets.find(std::type_index(typeid(wrapped_message<Msg>)));
+		if (it == buckets.end() || it->second.empty())
+			return nullptr;
+		return &it->second;
+	}
+
+	std::shared_ptr<message_base> take(bucket& b)
+	{
+		std::shared_ptr<message_base> msg = std::move(b.front().msg);
+		b.pop_front();
+		--count;
+		return msg;
+	}
+
+	template<typename Msg>
+	void discard()
+	{
+		if (bucket* const b = find<Msg>())
+		{
+			count -= b->size();
+			b->clear();
+		}
+	}
+
+	void clear()
+	{
+		buckets.clear();
+		count = 0;
+	}
+
+	std::size_t size() const
+	{
+		return count;
+	}
+};
+
+}
@@ -6,7 +6,7 @@ namespace messaging
 template<typename PreviousDispatcher, typename Msg, typename Func>
 class TemplateDispatcher
 {
-	queue* q;
+	receive_context ctx;
 	PreviousDispatcher* prev;
 	Func f;
 	bool chained;
@@ -17,23 +17,27 @@ class TemplateDispatcher
 	template<typename Dispatcher, typename OtherMsg, typename OtherFunc>
 	friend class TemplateDispatcher;
 
-	void wait_and_dispatch()
+	template<typename Chain>
+	friend void wait_and_dispatch(Chain& chain, receive_context const& ctx);
+
+	// A message stashed by an earlier chain goes first, the oldest one of
+	// the types this chain handles
+	stash::bucket* oldest_stashed()
 	{
-		for (;;)
-		{
-			auto msg = q->wait_and_pop();
-			if (dispatch(msg))
-				break;
-		}
+		stash::bucket* const older = prev->oldest_stashed();
+		stash::bucket* const mine = ctx.stashed->template find<Msg>();
+		if (!mine || (older && older->front().seq < mine->front().seq))
+			return older;
+		return mine;
 	}
 
-	bool dispatch(std::shared_ptr<message_base> const& msg)
+	dispatch_status dispatch(std::shared_ptr<message_base> const& msg)
 	{
 		if (wrapped_message<Msg>* wrapper =
 			dynamic_cast<wrapped_message<Msg>*>(msg.get()))
 		{
 			f(wrapper->contents);
-			return true;
+			return dispatch_handled;
 		}
 		else
 		{
@@ -42,14 +46,14 @@ class TemplateDispatcher
 	}
 public:
 	TemplateDispatcher(TemplateDispatcher&& other) :
-		q(other.q), prev(other.prev), f(std::move(other.f)),
+		ctx(other.ctx), prev(other.prev), f(std::move(other.f)),
 		chained(other.chained)
 	{
 		other.chained = true;
 	}
 
-	TemplateDispatcher(queue* q_, PreviousDispatcher* prev_, Func&& f_) :
-		q(q_), prev(prev_), f(std::forward<Func>(f_)), chained(false)
+	TemplateDispatcher(receive_context const& ctx_, PreviousDispatcher* prev_, Func&& f_) :
+		ctx(ctx_), prev(prev_), f(std::forward<Func>(f_)), chained(false)
 	{
 		prev_->chained = true;
 	}
@@ -60,14 +64,14 @@ public:
 	{
 		return TemplateDispatcher<
 			TemplateDispatcher, OtherMsg, OtherFunc>(
-				q, this, std::forward<OtherFunc>(of));
+				ctx, this, std::forward<OtherFunc>(of));
 	}
 
-	~TemplateDispatcher() noexcept(false)
+	~TemplateDispatcher()
 	{
 		if (!chained)
 		{
-			wait_and_dispatch();
+			wait_and_dispatch(*this, ctx);
 		}
 	}
 };
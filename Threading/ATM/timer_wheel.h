@@ -0,0 +1,306 @@
+#pragma once
+
+#include <chrono>
+#include <functional>
+#include <vector>
+#include <cstdint>
+
+#include "../../LF/bits.h"
+
+namespace messaging
+{
+
+// Hierarchical timing wheel (Varghese & Lauck) owned by one actor thread.
+//
+// Level k has 64 slots of 64^k ticks each, a tick is one millisecond. A
+// timer sits in an intrusive list in the slot of the coarsest level that
+// still tells it apart from now, so schedule and cancel are O(1). Every
+// time the current tick crosses a slot boundary of level k, that slot is
+// cascaded into the finer levels; level 0 slots are fired as they pass.
+// Deadlines beyond the last level wait in its furthest slot and are
+// cascaded again until they fit.
+//
+// Timer nodes are recycled but never freed while the wheel lives, and a
+// handle carries the generation of its node, so cancelling a timer that
+// already fired is harmless.
+class timer_wheel
+{
+public:
+	typedef std::chrono::steady_clock clock;
+	typedef std::chrono::milliseconds tick;
+
+private:
+	static unsigned const slot_bits = 6;
+	static unsigned const slots = 1u << slot_bits;
+	static unsigned const levels = 4;
+
+	struct link
+	{
+		link* prev;
+		link* next;
+	};
+
+	struct node : link
+	{
+		std::uint64_t expires;
+		std::uint64_t generation;
+		unsigned level;
+		unsigned slot;
+		std::function<void()> action;
+	};
+
+	link wheel[levels][slots];
+	std::uint64_t occupied[levels];
+	link due;
+	std::vector<node*> free_nodes;
+	std::vector<node*> all_nodes;
+	clock::time_point start;
+	std::uint64_t current;
+	std::size_t count;
+
+	timer_wheel(timer_wheel const&) = delete;
+	timer_wheel& operator=(timer_wheel const&) = delete;
+
+	// Ticks from slot 'from' (exclusive) to the next occupied slot, 1..64
+	static unsigned distance_to_next(std::uint64_t mask, unsigned from)
+	{
+		unsigned const first = (from + 1) & (slots - 1);
+		std::uint64_t const rotated = first ? (mask >> first) | (mask << (slots - first)) : mask;
+		return LowestSetBit(rotated) + 1;
+	}
+
+	static void unlink(link* l)
+	{
+		l->prev->next = l->next;
+		l->next->prev = l->prev;
+	}
+
+	static void link_before(link* head, link* l)
+	{
+		l->prev = head->prev;
+		l->next = head;
+		head->prev->next = l;
+		head->prev = l;
+	}
+
+	std::uint64_t tick_of(clock::time_point t) const
+	{
+		if (t <= start)
+			return 0;
+		return static_cast<std::uint64_t>(std::chrono::duration_cast<tick>(t - start).count());
+	}
+
+	void place(node* n)
+	{
+		if (n->expires <= current)
+		{
+			n->level = levels;
+			link_before(&due, n);
+			return;
+		}
+
+		std::uint64_t const max_span = (std::uint64_t(1) << (slot_bits * levels)) - 1;
+		std::uint64_t delta = n->expires - current;
+		if (delta > max_span)
+			delta = max_span;
+
+		unsigned level = 0;
+		while (level + 1 < levels && delta >= (std::uint64_t(1) << (slot_bits * (level + 1))))
+			++level;
+		unsigned const slot = static_cast<unsigned>(((current + delta) >> (slot_bits * level)) & (slots - 1));
+
+		n->level = level;
+		n->slot = slot;
+		link_before(&wheel[level][slot], n);
+		occupied[level] |= std::uint64_t(1) << slot;
+	}
+
+	void remove(node* n)
+	{
+		unlink(n);
+		if (n->level < levels && wheel[n->level][n->slot].next == &wheel[n->level][n->slot])
+			occupied[n->level] &= ~(std::uint64_t(1) << n->slot);
+	}
+
+	void recycle(node* n)
+	{
+		n->action = nullptr;
+		++n->generation;
+		free_nodes.push_back(n);
+		--count;
+	}
+
+	// Detaches every timer of a list first, so actions may schedule and
+	// cancel timers while it runs
+	void fire(link* head)
+	{
+		while (head->next != head)
+		{
+			node* const n = static_cast<node*>(head->next);
+			unlink(n);
+			std::function<void()> action = std::move(n->action);
+			recycle(n);
+			action();
+		}
+	}
+
+	// First tick after the current one at which a level 0 slot fires or an
+	// occupied slot of a coarser level cascades
+	std::uint64_t next_tick() const
+	{
+		std::uint64_t next = ~std::uint64_t(0);
+		for (unsigned l = 0; l < levels; ++l)
+		{
+			if (!occupied[l])
+				continue;
+			unsigned const shift = slot_bits * l;
+			std::uint64_t const base = current >> shift;
+			unsigned const from = static_cast<unsigned>(base & (slots - 1));
+			std::uint64_t const at = (base + distance_to_next(occupied[l], from)) << shift;
+			if (at < next)
+				next = at;
+		}
+		return next;
+	}
+
+	void cascade(unsigned level, unsigned slot)
+	{
+		link* const head = &wheel[level][slot];
+		occupied[level] &= ~(std::uint64_t(1) << slot);
+		link pending = { &pending, &pending };
+		if (head->next != head)
+		{
+			pending.next = head->next;
+			pending.prev = head->prev;
+			pending.next->prev = &pending;
+			pending.prev->next = &pending;
+			head->next = head->prev = head;
+		}
+		while (pending.next != &pending)
+		{
+			node* const n = static_cast<node*>(pending.next);
+			unlink(n);
+			place(n);
+		}
+	}
+
+public:
+	class handle
+	{
+		node* n;
+		std::uint64_t generation;
+		friend class timer_wheel;
+	public:
+		handle() : n(nullptr), generation(0)
+		{}
+	};
+
+	explicit timer_wheel(clock::time_point start_ = clock::now()) :
+		start(start_), current(0), count(0)
+	{
+		for (unsigned l = 0; l < levels; ++l)
+		{
+			occupied[l] = 0;
+			for (unsigned s = 0; s < slots; ++s)
+				wheel[l][s].prev = wheel[l][s].next = &wheel[l][s];
+		}
+		due.prev = due.next = &due;
+	}
+
+	~timer_wheel()
+	{
+		for (node* n : all_nodes)
+			delete n;
+	}
+
+	template<typename Action>
+	handle schedule(clock::time_point deadline, Action&& action)
+	{
+		node* n;
+		if (free_nodes.empty())
+		{
+			n = new node;
+			n->generation = 0;
+			all_nodes.push_back(n);
+		}
+		else
+		{
+			n = free_nodes.back();
+			free_nodes.pop_back();
+		}
+		// Round up, a timer never fires before its deadline
+		n->expires = tick_of(deadline + tick(1) - clock::duration(1));
+		n->action = std::forward<Action>(action);
+		place(n);
+		++count;
+
+		handle h;
+		h.n = n;
+		h.generation = n->generation;
+		return h;
+	}
+
+	template<typename Rep, typename Period, typename Action>
+	handle schedule_after(std::chrono::duration<Rep, Period> const& delay, Action&& action)
+	{
+		return schedule(clock::now() + delay, std::forward<Action>(action));
+	}
+
+	// false when the timer already fired or was cancelled
+	bool cancel(handle h)
+	{
+		if (!h.n || h.n->generation != h.generation)
+			return false;
+		remove(h.n);
+		recycle(h.n);
+		return true;
+	}
+
+	// Runs the actions of every timer due by now. Ticks where no slot
+	// fires or cascades are skipped.
+	void advance(clock::time_point now)
+	{
+		std::uint64_t const target = tick_of(now);
+		fire(&due);
+		while (current < target)
+		{
+			std::uint64_t const next = next_tick();
+			if (next > target)
+			{
+				current = target;
+				break;
+			}
+
+			current = next;
+			for (unsigned l = levels - 1; l > 0; --l)
+			{
+				std::uint64_t const span = std::uint64_t(1) << (slot_bits * l);
+				if (!(current & (span - 1)))
+					cascade(l, static_cast<unsigned>((current >> (slot_bits * l)) & (slots - 1)));
+			}
+
+			unsigned const slot = static_cast<unsigned>(current & (slots - 1));
+			occupied[0] &= ~(std::uint64_t(1) << slot);
+			fire(&wheel[0][slot]);
+			fire(&due);
+		}
+	}
+
+	// When advance next has something to do, false when no timer is set.
+	// For timers on the coarser levels this is the cascade that moves them
+	// down, so a waiter may wake up before anything fires.
+	bool next_expiry(clock::time_point& when) const
+	{
+		if (!count)
+			return false;
+		when = start + tick(due.next != &due ? current : next_tick());
+		return true;
+	}
+
+	std::size_t size() const
+	{
+		return count;
+	}
+};
+
+}
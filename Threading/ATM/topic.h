@@ -0,0 +1,95 @@
+#pragma once
+
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+#include <cstdint>
+
+#include "queue.h"
+#include "sender.h"
+
+namespace messaging
+{
+
+// Broadcast to every subscribed receiver. publish wraps the message once
+// and queues that same wrapper with each subscriber, so a fan-out to N
+// receivers costs one copy of the message and N reference count
+// increments instead of N copies. Handlers only ever see the contents by
+// const reference, which keeps the shared message immutable.
+//
+// The subscriber list is copied on write and publish only holds the lock
+// while it takes the current list, so a subscriber whose bounded mailbox
+// blocks the publisher does not keep others from subscribing, unsubscribing
+// or publishing. A publish that took the list before unsubscribe may still
+// queue its message after unsubscribe returns; the mailbox of a receiver
+// has to outlive publishes already under way.
+class topic
+{
+public:
+	typedef std::uint64_t subscription;
+
+private:
+	typedef std::vector<std::pair<subscription, sender> > subscriber_list;
+
+	std::mutex m;
+	std::shared_ptr<subscriber_list const> subscribers;
+	subscription last_id = 0;
+
+	topic(topic const&) = delete;
+	topic& operator=(topic const&) = delete;
+
+public:
+	topic() : subscribers(std::make_shared<subscriber_list>())
+	{}
+
+	subscription subscribe(sender s)
+	{
+		std::lock_guard<std::mutex> lk(m);
+		std::shared_ptr<subscriber_list> const updated = std::make_shared<subscriber_list>(*subscribers);
+		updated->push_back(std::make_pair(++last_id, s));
+		subscribers = updated;
+		return last_id;
+	}
+
+	bool unsubscribe(subscription id)
+	{
+		std::lock_guard<std::mutex> lk(m);
+		for (std::size_t i = 0; i < subscribers->size(); ++i)
+		{
+			if ((*subscribers)[i].first == id)
+			{
+				std::shared_ptr<subscriber_list> const updated = std::make_shared<subscriber_list>(*subscribers);
+				updated->erase(updated->begin() + i);
+				subscribers = updated;
+				return true;
+			}
+		}
+		return false;
+	}
+
+	template<typename Message>
+	void publish(Message const& msg)
+	{
+		std::shared_ptr<wrapped_message<Message> > const wrapped =
+			std::make_shared<wrapped_message<Message> >(msg);
+		std::shared_ptr<subscriber_list const> current;
+		{
+			std::lock_guard<std::mutex> lk(m);
+			current = subscribers;
+		}
+		for (auto const& s : *current)
+		{
+			sender target = s.second;
+			target.send_wrapped(wrapped);
+		}
+	}
+
+	std::size_t size()
+	{
+		std::lock_guard<std::mutex> lk(m);
+		return subscribers->size();
+	}
+};
+
+}
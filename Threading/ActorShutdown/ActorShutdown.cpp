@@ -0,0 +1,103 @@
+#include "stdafx.h"
+#include <iostream>
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+#include <chrono>
+#include <future>
+
+#include "../ATM/receiver.h"
+#include "../ATM/template_dispatcher.h"
+
+using namespace std;
+
+struct work
+{
+	unsigned amount;
+};
+
+// One actor per thread, like atm and bank_machine: handles work until its
+// receiver closes
+class worker
+{
+	messaging::receiver incoming;
+	unsigned total;
+public:
+	worker() : total(0)
+	{}
+
+	void run(atomic<unsigned>& started, shared_future<void> gate)
+	{
+		started.fetch_add(1);
+		gate.wait();
+		while (!incoming.closed())
+		{
+			incoming.wait().handle<work>([&](work const& msg)
+				{
+					total += msg.amount;
+				}
+			);
+		}
+	}
+
+	messaging::sender get_sender()
+	{
+		return incoming;
+	}
+
+	size_t drained() const
+	{
+		return incoming.drained();
+	}
+};
+
+// The actors are held at a gate until 'backlog' messages and close_queue
+// are queued for each of them, so every one drains before it stops. Only
+// the shutdown is timed: from opening the gate until the last thread is
+// joined.
+void Benchmark(unsigned actorsCount, unsigned backlog)
+{
+	vector<unique_ptr<worker>> workers;
+	vector<thread> threads;
+	atomic<unsigned> started(0);
+	promise<void> open;
+	shared_future<void> gate(open.get_future());
+
+	for (unsigned i = 0; i < actorsCount; i++)
+		workers.emplace_back(new worker);
+	for (unsigned i = 0; i < actorsCount; i++)
+		threads.emplace_back(&worker::run, workers[i].get(), ref(started), gate);
+	while (started.load() != actorsCount)
+		this_thread::sleep_for(chrono::milliseconds(1));
+
+	for (unsigned i = 0; i < actorsCount; i++)
+	{
+		messaging::sender s = workers[i]->get_sender();
+		for (unsigned j = 0; j < backlog; j++)
+			s.send(work{1});
+		s.send(messaging::close_queue());
+	}
+
+	auto const start = chrono::steady_clock::now();
+	open.set_value();
+	for (thread& t : threads)
+		t.join();
+	chrono::duration<double, milli> const elapsed = chrono::steady_clock::now() - start;
+
+	size_t drained = 0;
+	for (unique_ptr<worker> const& w : workers)
+		drained += w->drained();
+
+	cout << actorsCount << " actors, " << backlog << " queued each: shutdown "
+		 << elapsed.count() << " ms, " << drained << " messages drained" << endl;
+}
+
+int main()
+{
+	Benchmark(1000, 0);
+	Benchmark(10000, 0);
+	Benchmark(10000, 16);
+
+	return 0;
+}
@@ -0,0 +1,102 @@
+#include "stdafx.h"
+#include <iostream>
+#include <thread>
+#include <chrono>
+
+#include "../ATM/receiver.h"
+#include "../ATM/template_dispatcher.h"
+
+using namespace std;
+
+struct reading
+{
+	unsigned value;
+};
+
+// Handles readings slower than they are produced
+class slow_consumer
+{
+	messaging::receiver incoming;
+	unsigned handled;
+	unsigned last;
+public:
+	slow_consumer() : handled(0), last(0)
+	{}
+
+	void run()
+	{
+		while (!incoming.closed())
+		{
+			incoming.wait().handle<reading>([&](reading const& msg)
+				{
+					auto const until = chrono::steady_clock::now() + chrono::microseconds(2);
+					while (chrono::steady_clock::now() < until)
+						;
+					last = msg.value;
+					++handled;
+				}
+			);
+		}
+	}
+
+	void set_capacity(size_t capacity, messaging::overflow_policy policy)
+	{
+		incoming.set_capacity(capacity, policy);
+	}
+
+	messaging::sender get_sender()
+	{
+		return incoming;
+	}
+
+	messaging::queue_stats stats()
+	{
+		return incoming.mailbox_stats();
+	}
+
+	unsigned get_handled() const
+	{
+		return handled;
+	}
+
+	unsigned get_last() const
+	{
+		return last;
+	}
+};
+
+void Benchmark(char const* name, unsigned messagesCount, size_t capacity,
+	messaging::overflow_policy policy)
+{
+	slow_consumer c;
+	c.set_capacity(capacity, policy);
+	messaging::sender s = c.get_sender();
+
+	auto const start = chrono::steady_clock::now();
+	thread consumer_thread(&slow_consumer::run, &c);
+	for (unsigned i = 1; i <= messagesCount; i++)
+		s.send(reading{i});
+	s.send(messaging::close_queue());
+	consumer_thread.join();
+	chrono::duration<double, milli> const elapsed = chrono::steady_clock::now() - start;
+
+	messaging::queue_stats const stats = c.stats();
+	cout << name << ": " << elapsed.count() << " ms, handled " << c.get_handled()
+		 << " (last " << c.get_last() << "), high water " << stats.high_water
+		 << ", refused " << stats.refused << ", dropped " << stats.dropped
+		 << ", coalesced " << stats.coalesced << ", blocked " << stats.blocked << endl;
+}
+
+int main()
+{
+	unsigned const messagesCount = 200000;
+	size_t const capacity = 256;
+
+	Benchmark("unbounded   ", messagesCount, 0, messaging::overflow_block);
+	Benchmark("block       ", messagesCount, capacity, messaging::overflow_block);
+	Benchmark("fail        ", messagesCount, capacity, messaging::overflow_fail);
+	Benchmark("drop oldest ", messagesCount, capacity, messaging::overflow_drop_oldest);
+	Benchmark("coalesce    ", messagesCount, capacity, messaging::overflow_coalesce);
+
+	return 0;
+}
@@ -0,0 +1,107 @@
+#include "stdafx.h"
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include <chrono>
+
+#include "../ATM/receiver.h"
+#include "../ATM/template_dispatcher.h"
+#include "../ATM/topic.h"
+
+using namespace std;
+
+// A status line shown on every display, big enough that copying it shows
+struct status
+{
+	string text;
+};
+
+class display
+{
+	messaging::receiver incoming;
+	size_t characters;
+public:
+	display() : characters(0)
+	{}
+
+	void run()
+	{
+		while (!incoming.closed())
+		{
+			incoming.wait().handle<status>([&](status const& msg)
+				{
+					characters += msg.text.size();
+				}
+			);
+		}
+	}
+
+	messaging::sender get_sender()
+	{
+		return incoming;
+	}
+
+	size_t shown() const
+	{
+		return characters;
+	}
+};
+
+// Sends 'messagesCount' status updates to every display, either through a
+// topic or with one send per display, and times it until every display has
+// handled all of them
+void Benchmark(unsigned displaysCount, unsigned messagesCount, bool useTopic)
+{
+	vector<unique_ptr<display>> displays;
+	vector<thread> threads;
+	messaging::topic updates;
+	vector<messaging::sender> senders;
+
+	for (unsigned i = 0; i < displaysCount; i++)
+	{
+		displays.emplace_back(new display);
+		senders.push_back(displays[i]->get_sender());
+		updates.subscribe(displays[i]->get_sender());
+	}
+	for (unsigned i = 0; i < displaysCount; i++)
+		threads.emplace_back(&display::run, displays[i].get());
+
+	status const msg = { string(512, '#') };
+	auto const start = chrono::steady_clock::now();
+	for (unsigned i = 0; i < messagesCount; i++)
+	{
+		if (useTopic)
+		{
+			updates.publish(msg);
+		}
+		else
+		{
+			for (messaging::sender& s : senders)
+				s.send(msg);
+		}
+	}
+	updates.publish(messaging::close_queue());
+	for (thread& t : threads)
+		t.join();
+	chrono::duration<double, milli> const elapsed = chrono::steady_clock::now() - start;
+
+	size_t shown = 0;
+	for (unique_ptr<display> const& d : displays)
+		shown += d->shown();
+
+	cout << (useTopic ? "topic:   " : "senders: ") << displaysCount << " displays, "
+		 << messagesCount << " updates: " << elapsed.count() << " ms ("
+		 << shown << " characters shown)" << endl;
+}
+
+int main()
+{
+	Benchmark(4, 100000, false);
+	Benchmark(4, 100000, true);
+	Benchmark(32, 20000, false);
+	Benchmark(32, 20000, true);
+
+	return 0;
+}
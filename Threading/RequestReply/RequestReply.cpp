@@ -0,0 +1,123 @@
+#include "stdafx.h"
+#include <iostream>
+#include <thread>
+#include <chrono>
+#include <vector>
+
+#include "../ATM/bank_machine.h"
+
+using namespace std;
+
+// The main thread acts as a client of bank_machine: it keeps up to 'window'
+// get_balance requests outstanding and waits whenever the window is full.
+// With a window of 1 every request waits for the previous reply, which is
+// what the atm does.
+void Benchmark(unsigned requestsCount, unsigned window)
+{
+	messaging::bank_machine bank;
+	thread bank_thread(&messaging::bank_machine::run, &bank);
+	messaging::sender target = bank.get_sender();
+	messaging::receiver incoming;
+	messaging::account_id const account = messaging::account_table::instance().intern("acc1234");
+
+	unsigned sent = 0;
+	unsigned answered = 0;
+	unsigned long long total = 0;
+
+	auto const start = chrono::steady_clock::now();
+	while (answered < requestsCount)
+	{
+		while (sent < requestsCount && incoming.outstanding() < window)
+		{
+			incoming.request<get_balance>(target, account).then<balance>([&](balance const& msg)
+				{
+					total += msg.amount;
+					++answered;
+				}
+			);
+			++sent;
+		}
+		incoming.wait();
+	}
+	chrono::duration<double, milli> const elapsed = chrono::steady_clock::now() - start;
+
+	bank.done();
+	bank_thread.join();
+
+	cout << requestsCount << " requests, window " << window << ": "
+		 << elapsed.count() << " ms, "
+		 << static_cast<unsigned>(requestsCount / elapsed.count() * 1000) << " replies/s"
+		 << " (checksum " << total << ")" << endl;
+}
+
+// Any worker of the bank takes any request, so withdrawals from several
+// workers race to install their copy of the ledger while others read it.
+// Withdrawals of 1 until every account is refused; whatever was granted plus
+// what is left must be the 199 each account started with.
+bool Consistency(size_t workers, unsigned accountsCount)
+{
+	messaging::bank_machine bank(workers, false);
+	thread bank_thread(&messaging::bank_machine::run, &bank);
+	messaging::sender target = bank.get_sender();
+	messaging::receiver incoming;
+
+	vector<messaging::account_id> accounts;
+	for (unsigned i = 0; i < accountsCount; ++i)
+		accounts.push_back(messaging::account_table::instance().intern("consistency" + to_string(i)));
+	vector<unsigned> granted(accountsCount, 0);
+	vector<bool> refused(accountsCount, false);
+	unsigned refusedCount = 0;
+
+	unsigned next = 0;
+	while (refusedCount < accountsCount)
+	{
+		while (incoming.outstanding() < 64)
+		{
+			unsigned const i = next++ % accountsCount;
+			incoming.request<withdraw>(target, accounts[i], 1u).then<withdraw_ok>([&, i](withdraw_ok const&)
+				{
+					++granted[i];
+				}
+			).then<withdraw_denied>([&, i](withdraw_denied const&)
+				{
+					if (!refused[i])
+					{
+						refused[i] = true;
+						++refusedCount;
+					}
+				}
+			);
+			incoming.request<get_balance>(target, accounts[i]);
+		}
+		incoming.wait();
+	}
+	while (incoming.outstanding())
+		incoming.wait();
+
+	bool ok = true;
+	for (unsigned i = 0; i < accountsCount; ++i)
+	{
+		incoming.request<get_balance>(target, accounts[i]).then<balance>([&, i](balance const& msg)
+			{
+				if (granted[i] + msg.amount != 199)
+					ok = false;
+			}
+		);
+		incoming.wait();
+	}
+
+	bank.done();
+	bank_thread.join();
+	return ok;
+}
+
+int main()
+{
+	cout << "ledger consistency, 4 workers: " << (Consistency(4, 8) ? "ok" : "FAILED") << endl;
+
+	Benchmark(200000, 1);
+	Benchmark(200000, 16);
+	Benchmark(200000, 256);
+
+	return 0;
+}
@@ -0,0 +1,109 @@
+#include "stdafx.h"
+#include <iostream>
+#include <algorithm>
+#include <thread>
+#include <vector>
+#include <chrono>
+
+#include "../ATM/receiver.h"
+#include "../ATM/template_dispatcher.h"
+
+using namespace std;
+
+struct item
+{
+	unsigned source;
+};
+
+// Counts what every producer got through. Halfway through, the counts are
+// kept to show how evenly the sources were served.
+class consumer
+{
+	messaging::receiver incoming;
+	vector<unsigned> handled;
+	vector<unsigned> halfway;
+	unsigned total;
+	unsigned expected;
+public:
+	consumer(unsigned sourcesCount, unsigned expected_) :
+		handled(sourcesCount), total(0), expected(expected_)
+	{}
+
+	void run()
+	{
+		while (!incoming.closed())
+		{
+			incoming.wait().handle<item>([&](item const& msg)
+				{
+					++handled[msg.source];
+					if (++total == expected / 2)
+						halfway = handled;
+				}
+			);
+		}
+	}
+
+	messaging::sender get_sender()
+	{
+		return incoming;
+	}
+
+	messaging::sender add_mailbox()
+	{
+		return incoming.add_mailbox();
+	}
+
+	unsigned get_total() const
+	{
+		return total;
+	}
+
+	vector<unsigned> const& get_halfway() const
+	{
+		return halfway;
+	}
+};
+
+// Every producer floods the consumer, either all through its one mailbox
+// or each through a mailbox of its own
+void Benchmark(unsigned producersCount, unsigned messagesCount, bool ownMailboxes)
+{
+	consumer c(producersCount, producersCount * messagesCount);
+	vector<messaging::sender> senders;
+	for (unsigned i = 0; i < producersCount; i++)
+		senders.push_back(ownMailboxes ? c.add_mailbox() : c.get_sender());
+
+	auto const start = chrono::steady_clock::now();
+	thread consumer_thread(&consumer::run, &c);
+	vector<thread> producers;
+	for (unsigned i = 0; i < producersCount; i++)
+	{
+		producers.emplace_back([&senders, i, messagesCount]
+			{
+				for (unsigned j = 0; j < messagesCount; j++)
+					senders[i].send(item{i});
+			}
+		);
+	}
+	for (thread& t : producers)
+		t.join();
+	c.get_sender().send(messaging::close_queue());
+	consumer_thread.join();
+	chrono::duration<double, milli> const elapsed = chrono::steady_clock::now() - start;
+
+	vector<unsigned> const& halfway = c.get_halfway();
+	cout << (ownMailboxes ? "mailbox each: " : "one mailbox:  ") << producersCount
+		 << " producers, " << c.get_total() << " messages: " << elapsed.count()
+		 << " ms, halfway per producer min " << *min_element(halfway.begin(), halfway.end())
+		 << " max " << *max_element(halfway.begin(), halfway.end()) << endl;
+}
+
+int main()
+{
+	Benchmark(4, 250000, false);
+	Benchmark(4, 250000, true);
+	Benchmark(16, 62500, false);
+	Benchmark(16, 62500, true);
+
+	return 0;
+}
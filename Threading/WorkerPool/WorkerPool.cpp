@@ -0,0 +1,153 @@
+#include "stdafx.h"
+#include <iostream>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <thread>
+#include <vector>
+#include <chrono>
+
+#include "../ATM/pool.h"
+#include "../ATM/template_dispatcher.h"
+
+using namespace std;
+
+struct lookup
+{
+	unsigned account;
+	unsigned seq;
+	mutable messaging::reply_to reply;
+	lookup(unsigned account_, unsigned seq_, messaging::reply_to reply_) :
+		account(account_), seq(seq_), reply(reply_)
+	{}
+};
+
+struct found
+{
+	unsigned account;
+};
+
+namespace messaging
+{
+
+template<>
+struct affinity_key<lookup>
+{
+	static bool get(lookup const& msg, std::size_t& key)
+	{
+		key = msg.account;
+		return true;
+	}
+};
+
+}
+
+// Every lookup waits for the ledger, like a handler that does I/O, for half
+// to one and a half times 'latency'. A lookup handled after a later one of
+// the same account is counted as out of order.
+class ledger_service
+{
+	messaging::worker_pool pool;
+	vector<atomic<unsigned>> last_seq;
+	atomic<unsigned> out_of_order;
+	chrono::microseconds latency;
+
+	void serve(messaging::receiver& incoming)
+	{
+		while (!incoming.closed())
+		{
+			incoming.wait().handle<lookup>([&](lookup const& msg)
+				{
+					this_thread::sleep_for(latency * (msg.seq % 3 + 1) / 2);
+					if (last_seq[msg.account].exchange(msg.seq) > msg.seq)
+						out_of_order.fetch_add(1);
+					msg.reply.send(found{msg.account});
+				}
+			);
+		}
+	}
+
+public:
+	ledger_service(size_t workers, bool keyAffinity, unsigned accountsCount,
+		chrono::microseconds latency_) :
+		pool(workers, keyAffinity), last_seq(accountsCount), out_of_order(0), latency(latency_)
+	{
+		for (atomic<unsigned>& s : last_seq)
+			s.store(0);
+	}
+
+	void run()
+	{
+		vector<thread> threads;
+		for (size_t i = 1; i < pool.size(); ++i)
+			threads.emplace_back(&ledger_service::serve, this, ref(pool.worker(i)));
+		serve(pool.worker(0));
+		for (thread& t : threads)
+			t.join();
+	}
+
+	void done()
+	{
+		pool.done();
+	}
+
+	messaging::sender get_sender()
+	{
+		return pool.get_sender();
+	}
+
+	unsigned get_out_of_order() const
+	{
+		return out_of_order.load();
+	}
+};
+
+// The client keeps 'window' lookups outstanding, spread over the accounts
+void Benchmark(size_t workers, bool keyAffinity, unsigned requestsCount)
+{
+	unsigned const accountsCount = 4;
+	unsigned const window = 64;
+
+	ledger_service service(workers, keyAffinity, accountsCount, chrono::microseconds(100));
+	thread service_thread(&ledger_service::run, &service);
+	messaging::sender target = service.get_sender();
+	messaging::receiver incoming;
+	vector<unsigned> seq(accountsCount, 0);
+
+	unsigned sent = 0;
+	unsigned answered = 0;
+	auto const start = chrono::steady_clock::now();
+	while (answered < requestsCount)
+	{
+		while (sent < requestsCount && incoming.outstanding() < window)
+		{
+			unsigned const account = sent % accountsCount;
+			incoming.request<lookup>(target, account, ++seq[account]).then<found>([&](found const&)
+				{
+					++answered;
+				}
+			);
+			++sent;
+		}
+		incoming.wait();
+	}
+	chrono::duration<double, milli> const elapsed = chrono::steady_clock::now() - start;
+
+	service.done();
+	service_thread.join();
+
+	cout << workers << " workers" << (keyAffinity ? ", key affinity:    " : ", any worker:      ")
+		 << elapsed.count() << " ms, " << service.get_out_of_order() << " out of order" << endl;
+}
+
+int main()
+{
+	unsigned const requestsCount = 10000;
+	for (size_t workers : {1, 2, 4, 8})
+	{
+		Benchmark(workers, false, requestsCount);
+		Benchmark(workers, true, requestsCount);
+	}
+
+	return 0;
+}